@@ -0,0 +1,478 @@
+// Runtime benchmark harness: measures the code generate_asm produces rather
+// than the compiler itself. Every .jive file in a directory is compiled with
+// libjive, assembled with nasm, linked with ld, and run N times under
+// perf_event_open counters. Results go to results_dir/<commit>_<flags>.json
+// so runs with different compilers or codegen flags can be compared. A
+// benchmark that exits with a non-zero status or dies from a signal fails the
+// whole run.
+//
+//   gcc -O2 -fvisibility=hidden -c libjive.c -o libjive_hidden.o
+//   objcopy --localize-hidden libjive_hidden.o libjive.o
+//   gcc -O2 bench_runtime.c libjive.o -o bench_runtime
+//   ./bench_runtime [benchmarks] [-n runs] [-o results_dir] [--fold-identical] [--profile-use=file] [--unroll=n] [--naive-loops] [--unbuffered-print] [--match-chains] [--commit=label]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "jive.h"
+
+typedef enum Counter
+{
+	COUNTER_cycles,
+	COUNTER_instructions,
+	COUNTER_branch_misses,
+	COUNTER_icache_misses,
+	COUNTER_COUNT,
+} Counter;
+
+const char *counter_names[COUNTER_COUNT] = {
+	[COUNTER_cycles]        = "cycles",
+	[COUNTER_instructions]  = "instructions",
+	[COUNTER_branch_misses] = "branch_misses",
+	[COUNTER_icache_misses] = "icache_misses",
+};
+
+const struct { unsigned type; unsigned long config; } counter_events[COUNTER_COUNT] = {
+	[COUNTER_cycles]        = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	[COUNTER_instructions]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	[COUNTER_branch_misses] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	[COUNTER_icache_misses] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+	                                               (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	                                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+typedef struct Run_Sample
+{
+	long counters[COUNTER_COUNT]; // -1 when the counter isn't available
+	long wall_ns;
+	int exit_status; // -1 when the program was killed
+	int signal;      // Signal that killed the program, or 0
+} Run_Sample;
+
+// Counts only the child, starting at its exec so our own fork/exec work
+// doesn't show up in the numbers
+int open_counter(Counter counter, pid_t pid)
+{
+	struct perf_event_attr attr = {0};
+	attr.size = sizeof(attr);
+	attr.type = counter_events[counter].type;
+	attr.config = counter_events[counter].config;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+long now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+bool run_program(const char *exe_path, Run_Sample *sample)
+{
+	int go_pipe[2];
+	if (pipe(go_pipe) != 0) return false;
+	
+	pid_t pid = fork();
+	if (pid < 0) return false;
+	if (pid == 0)
+	{
+		// Wait until the counters are attached, then become the benchmark
+		close(go_pipe[1]);
+		char go;
+		if (read(go_pipe[0], &go, 1) != 1) _exit(127);
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, 1);
+		execl(exe_path, exe_path, (char *)NULL);
+		_exit(127);
+	}
+	close(go_pipe[0]);
+	
+	int fds[COUNTER_COUNT];
+	for (int i = 0; i < COUNTER_COUNT; i++)
+	{
+		fds[i] = open_counter((Counter)i, pid);
+	}
+	
+	long start = now_ns();
+	write(go_pipe[1], "g", 1);
+	close(go_pipe[1]);
+	
+	int status = 0;
+	waitpid(pid, &status, 0);
+	sample->wall_ns = now_ns() - start;
+	sample->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	sample->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+	
+	for (int i = 0; i < COUNTER_COUNT; i++)
+	{
+		sample->counters[i] = -1;
+		if (fds[i] < 0) continue;
+		long value = 0;
+		if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+		{
+			sample->counters[i] = value;
+		}
+		close(fds[i]);
+	}
+	return true;
+}
+
+int compare_longs(const void *a, const void *b)
+{
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+long median(long *values, long count)
+{
+	qsort(values, count, sizeof(long), compare_longs);
+	return values[count / 2];
+}
+
+// Short commit hash of the compiler being measured, marked -dirty if the
+// working tree has changes. The compiler is linked into this binary, so the
+// commit is looked up in the repository this binary lives in, not in the
+// current directory
+void get_compiler_commit(char *commit, long commit_size)
+{
+	snprintf(commit, commit_size, "unknown");
+	char exe_dir[1024];
+	long exe_len = readlink("/proc/self/exe", exe_dir, sizeof(exe_dir) - 1);
+	if (exe_len <= 0) return;
+	exe_dir[exe_len] = '\0';
+	char *last_slash = strrchr(exe_dir, '/');
+	if (last_slash == NULL) return;
+	*last_slash = '\0';
+	if (strchr(exe_dir, '\'') != NULL) return; // Can't be quoted for the shell below
+	
+	char command[1200];
+	snprintf(command, sizeof(command), "git -C '%s' rev-parse --short HEAD 2>/dev/null", exe_dir);
+	FILE *git = popen(command, "r");
+	if (git == NULL) return;
+	char line[128] = {0};
+	if (fgets(line, sizeof(line), git) != NULL && line[0] != '\0')
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		snprintf(command, sizeof(command), "git -C '%s' diff --quiet HEAD 2>/dev/null", exe_dir);
+		bool dirty = system(command) != 0;
+		snprintf(commit, commit_size, "%s%s", line, dirty ? "-dirty" : "");
+	}
+	pclose(git);
+}
+
+// The commit label names the results file and is written into its JSON, so
+// anything that isn't safe in both, like '/' or '"', becomes '_'
+void sanitize_commit_label(char *commit)
+{
+	for (char *c = commit; *c != '\0'; c++)
+	{
+		if (!isalnum((unsigned char)*c) && *c != '-' && *c != '.' && *c != '_') *c = '_';
+	}
+	if (commit[0] == '.') commit[0] = '_'; // Not a hidden file, nor "." or ".."
+}
+
+void remove_work_dir(const char *work_dir)
+{
+	char cleanup[256];
+	snprintf(cleanup, sizeof(cleanup), "rm -rf '%s'", work_dir);
+	system(cleanup);
+}
+
+void print_usage(const char *program_name)
+{
+	printf("Usage: %s [benchmark_dir] [-n runs] [-o results_dir] [--fold-identical] [--profile-use=file] [--unroll=n] [--naive-loops] [--unbuffered-print] [--match-chains] [--commit=label]\n", program_name);
+}
+
+int main(int arg_count, const char **args)
+{
+	const char *bench_dir_name = "benchmarks";
+	const char *results_dir_name = "bench_results";
+	long run_count = 10;
+	const char *commit_label = NULL;
+	Jive_Options options = {0};
+	char flags[512] = ""; // Codegen flags, as part of the results key
+	
+	int arg_index = 0;
+	const char *program_name = args[arg_index++];
+	while (arg_index < arg_count)
+	{
+		const char *arg = args[arg_index++];
+		if (strcmp(arg, "-n") == 0 && arg_index < arg_count)
+		{
+			run_count = atol(args[arg_index++]);
+		}
+		else if (strcmp(arg, "-o") == 0 && arg_index < arg_count)
+		{
+			results_dir_name = args[arg_index++];
+		}
+		else if (strcmp(arg, "--fold-identical") == 0)
+		{
+			options.fold_identical = true;
+			strcat(flags, "_fold-identical");
+		}
+		else if (strcmp(arg, "--naive-loops") == 0)
+		{
+			options.naive_loops = true;
+			strcat(flags, "_naive-loops");
+		}
+		else if (strcmp(arg, "--unbuffered-print") == 0)
+		{
+			options.unbuffered_print = true;
+			strcat(flags, "_unbuffered-print");
+		}
+		else if (strcmp(arg, "--match-chains") == 0)
+		{
+			options.match_chains = true;
+			strcat(flags, "_match-chains");
+		}
+		else if (strncmp(arg, "--unroll=", strlen("--unroll=")) == 0)
+		{
+			options.unroll_factor = atol(arg + strlen("--unroll="));
+			snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), "_unroll-%ld", options.unroll_factor);
+		}
+		else if (strncmp(arg, "--profile-use=", strlen("--profile-use=")) == 0)
+		{
+			options.profile_file_name = arg + strlen("--profile-use=");
+			strcat(flags, "_profile-use");
+		}
+		else if (strncmp(arg, "--commit=", strlen("--commit=")) == 0)
+		{
+			commit_label = arg + strlen("--commit=");
+		}
+		else if (arg[0] == '-')
+		{
+			printf("ERROR: Unrecognized argument %s\n", arg);
+			print_usage(program_name);
+			return 1;
+		}
+		else
+		{
+			bench_dir_name = arg;
+		}
+	}
+	if (run_count < 1) run_count = 1;
+	
+	char commit[160];
+	if (commit_label != NULL)
+	{
+		snprintf(commit, sizeof(commit), "%s", commit_label);
+	}
+	else
+	{
+		get_compiler_commit(commit, sizeof(commit));
+	}
+	sanitize_commit_label(commit);
+	
+	DIR *bench_dir = opendir(bench_dir_name);
+	if (!bench_dir)
+	{
+		printf("ERROR: Could not open directory %s\n", bench_dir_name);
+		return 1;
+	}
+	
+	// A profile only matches the program it was recorded from
+	if (options.profile_file_name != NULL)
+	{
+		long bench_count = 0;
+		for (struct dirent *entry = readdir(bench_dir); entry != NULL; entry = readdir(bench_dir))
+		{
+			long name_len = strlen(entry->d_name);
+			if (name_len > 5 && strcmp(entry->d_name + name_len - 5, ".jive") == 0) bench_count++;
+		}
+		if (bench_count > 1)
+		{
+			printf("ERROR: --profile-use needs a directory with a single benchmark, %s has %ld\n", bench_dir_name, bench_count);
+			closedir(bench_dir);
+			return 1;
+		}
+		rewinddir(bench_dir);
+	}
+	
+	char work_dir[] = "/tmp/jive_bench_XXXXXX";
+	if (mkdtemp(work_dir) == NULL)
+	{
+		printf("ERROR: Could not create a work directory\n");
+		return 1;
+	}
+	
+	mkdir(results_dir_name, 0755);
+	char results_file_name[1024];
+	snprintf(results_file_name, sizeof(results_file_name), "%s/%s%s.json",
+	         results_dir_name, commit, flags[0] ? flags : "_default");
+	FILE *results = fopen(results_file_name, "w");
+	if (!results)
+	{
+		printf("ERROR: Could not open %s for writing.\n", results_file_name);
+		closedir(bench_dir);
+		remove_work_dir(work_dir);
+		return 1;
+	}
+	fprintf(results, "{\n");
+	fprintf(results, "  \"commit\": \"%s\",\n", commit);
+	fprintf(results, "  \"flags\": \"%s\",\n", flags[0] ? flags + 1 : "");
+	fprintf(results, "  \"runs\": %ld,\n", run_count);
+	fprintf(results, "  \"benchmarks\": {");
+	
+	bool warned_unavailable[COUNTER_COUNT] = {0};
+	bool first_result = true;
+	bool all_ok = true;
+	for (struct dirent *entry = readdir(bench_dir); entry != NULL; entry = readdir(bench_dir))
+	{
+		long name_len = strlen(entry->d_name);
+		if (name_len <= 5 || strcmp(entry->d_name + name_len - 5, ".jive") != 0) continue;
+		int stem_len = (int)(name_len - 5);
+		
+		//
+		// Compile, assemble and link
+		//
+		
+		char path[2048];
+		snprintf(path, sizeof(path), "%s/%s", bench_dir_name, entry->d_name);
+		FILE *source_file = fopen(path, "rb");
+		if (!source_file)
+		{
+			printf("ERROR: Could not open file %s\n", path);
+			all_ok = false;
+			continue;
+		}
+		fseek(source_file, 0, SEEK_END);
+		long source_len = ftell(source_file);
+		fseek(source_file, 0, SEEK_SET);
+		char *source = malloc(source_len);
+		fread(source, 1, source_len, source_file);
+		fclose(source_file);
+		
+		Jive_Result compiled = jive_compile(path, source, source_len, &options);
+		free(source);
+		if (!compiled.success)
+		{
+			printf("ERROR: Failed to compile %s:\n%s", path, compiled.diagnostics);
+			jive_free_result(&compiled);
+			all_ok = false;
+			continue;
+		}
+		
+		char asm_path[2048], obj_path[2048], exe_path[2048], command[4 * 2048 + 64];
+		snprintf(asm_path, sizeof(asm_path), "%s/%.*s.asm", work_dir, stem_len, entry->d_name);
+		snprintf(obj_path, sizeof(obj_path), "%s/%.*s.o", work_dir, stem_len, entry->d_name);
+		snprintf(exe_path, sizeof(exe_path), "%s/%.*s", work_dir, stem_len, entry->d_name);
+		
+		FILE *asm_file = fopen(asm_path, "w");
+		fwrite(compiled.asm_text, 1, compiled.asm_len, asm_file);
+		fclose(asm_file);
+		jive_free_result(&compiled);
+		
+		snprintf(command, sizeof(command), "nasm -felf64 '%s' -o '%s' && ld '%s' -o '%s'",
+		         asm_path, obj_path, obj_path, exe_path);
+		if (system(command) != 0)
+		{
+			printf("ERROR: Failed to assemble and link %s\n", path);
+			all_ok = false;
+			continue;
+		}
+		
+		//
+		// Run it, keeping the median of every counter
+		//
+		
+		long *values[COUNTER_COUNT + 1];
+		for (int i = 0; i <= COUNTER_COUNT; i++)
+		{
+			values[i] = malloc(run_count * sizeof(long));
+		}
+		int exit_status = 0;
+		bool have_counter[COUNTER_COUNT];
+		for (int i = 0; i < COUNTER_COUNT; i++) have_counter[i] = true;
+		
+		bool ran_ok = true;
+		for (long run = 0; run < run_count; run++)
+		{
+			Run_Sample sample;
+			if (!run_program(exe_path, &sample))
+			{
+				printf("ERROR: Failed to run %s\n", exe_path);
+				for (int i = 0; i <= COUNTER_COUNT; i++) free(values[i]);
+				closedir(bench_dir);
+				fclose(results);
+				remove(results_file_name); // Incomplete, so not worth keeping
+				remove_work_dir(work_dir);
+				return 1;
+			}
+			if (sample.signal != 0)
+			{
+				printf("ERROR: %s was killed by signal %d\n", path, sample.signal);
+				ran_ok = false;
+				break;
+			}
+			if (sample.exit_status != 0)
+			{
+				printf("ERROR: %s exited with status %d\n", path, sample.exit_status);
+				ran_ok = false;
+				break;
+			}
+			for (int i = 0; i < COUNTER_COUNT; i++)
+			{
+				values[i][run] = sample.counters[i];
+				if (sample.counters[i] < 0) have_counter[i] = false;
+			}
+			values[COUNTER_COUNT][run] = sample.wall_ns;
+			exit_status = sample.exit_status;
+		}
+		if (!ran_ok)
+		{
+			for (int i = 0; i <= COUNTER_COUNT; i++) free(values[i]);
+			all_ok = false;
+			continue;
+		}
+		
+		fprintf(results, "%s\n    \"%.*s\": {", first_result ? "" : ",", stem_len, entry->d_name);
+		fprintf(results, "\"exit_status\": %d, \"wall_ns\": %ld", exit_status, median(values[COUNTER_COUNT], run_count));
+		for (int i = 0; i < COUNTER_COUNT; i++)
+		{
+			if (have_counter[i])
+			{
+				fprintf(results, ", \"%s\": %ld", counter_names[i], median(values[i], run_count));
+			}
+			else
+			{
+				fprintf(results, ", \"%s\": null", counter_names[i]);
+				if (!warned_unavailable[i])
+				{
+					printf("WARNING: %s not available from perf_event_open, recorded as null\n", counter_names[i]);
+					warned_unavailable[i] = true;
+				}
+			}
+		}
+		fprintf(results, "}");
+		first_result = false;
+		
+		printf("%.*s: %ld ns median over %ld runs\n", stem_len, entry->d_name, median(values[COUNTER_COUNT], run_count), run_count);
+		for (int i = 0; i <= COUNTER_COUNT; i++) free(values[i]);
+	}
+	closedir(bench_dir);
+	
+	fprintf(results, "\n  }\n}\n");
+	fclose(results);
+	printf("Results written to %s\n", results_file_name);
+	
+	remove_work_dir(work_dir);
+	
+	return all_ok ? 0 : 1;
+}
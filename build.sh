@@ -10,6 +10,28 @@ fi
 
 echo "Build success!"
 
+echo === BUILD LIBJIVE ===
+
+# Only the jive.h API may be exported. The internals are hidden in the
+# shared library, and made local in the static object, so they can't
+# collide with symbols of the program linking them in
+gcc -Wall -O2 -fPIC -fvisibility=hidden -shared ../code/libjive.c -o libjive.so &&
+	gcc -Wall -O2 -fvisibility=hidden -c ../code/libjive.c -o libjive_hidden.o &&
+	objcopy --localize-hidden libjive_hidden.o libjive.o
+ret_val=$?
+if [ $ret_val -ne 0 ]; then
+	echo ERROR: Failed to build libjive
+	exit $ret_val
+fi
+
+for exports in "$(nm -D --defined-only libjive.so)" "$(nm -g --defined-only libjive.o)"; do
+	names=$(echo "$exports" | awk '{print $3}' | sort | tr '\n' ' ')
+	if [ "$names" != "jive_compile jive_free_result " ]; then
+		echo ERROR: libjive exports more than the jive.h API: $names
+		exit 1
+	fi
+done
+
 echo === TEST ON SIMPLE.JIVE ===
 
 ./jive ../jive_programs/simple.jive -o simple.asm
@@ -19,6 +41,63 @@ if [ $ret_val -ne 0 ]; then
 	exit $ret_val
 fi
 
+echo === TEST ON A MISSING INPUT FILE ===
+
+./jive ../jive_programs/does_not_exist.jive -o missing.asm
+ret_val=$?
+if [ $ret_val -ne 1 ]; then
+	echo ERROR: Compiler returned $ret_val for a missing input file, expected 1
+	exit 1
+fi
+
+echo === TEST ON A PROGRAM WITHOUT MAIN ===
+
+printf 'fn helper() -> int\n{\n\treturn 1\n}\n' > no_main.jive
+./jive no_main.jive -o no_main.asm
+ret_val=$?
+if [ $ret_val -ne 1 ]; then
+	echo ERROR: Compiler returned $ret_val for a program without main, expected 1
+	exit 1
+fi
+if [ -e no_main.asm ]; then
+	echo ERROR: Compiler left no_main.asm behind after failing
+	exit 1
+fi
+
+echo === TEST ON DEEPLY NESTED MATCHES ===
+
+# 20,000 nested matches, which must not overflow the compiler's stack either
+{
+	printf 'fn main() -> int\n{\n\tlet i = 0\n'
+	printf 'match i\n{\n0 =>\n{\n%.0s' $(seq 20000)
+	printf 'i = i + 1\n'
+	printf '}\n}\n%.0s' $(seq 20000)
+	printf 'return i\n}\n'
+} > deep_match.jive
+./jive deep_match.jive -o deep_match.asm
+ret_val=$?
+if [ $ret_val -ne 0 ]; then
+	echo ERROR: Compiler returned an error compiling deeply nested matches
+	exit $ret_val
+fi
+
+echo === TEST ON DEEPLY NESTED LOOPS ===
+
+# 100,000 nested whiles, which must not overflow the compiler's stack
+{
+	printf 'fn main() -> int\n{\n\tlet i = 0\n'
+	printf 'while i < 1\n{\n%.0s' $(seq 100000)
+	printf 'i = i + 1\n'
+	printf '}\n%.0s' $(seq 100000)
+	printf 'return i\n}\n'
+} > deep_while.jive
+./jive deep_while.jive -o deep_while.asm
+ret_val=$?
+if [ $ret_val -ne 0 ]; then
+	echo ERROR: Compiler returned an error compiling deeply nested loops
+	exit $ret_val
+fi
+
 # nasm -felf64 simple.asm
 # ret_val=$?
 # if [ $ret_val -ne 0 ]; then
@@ -1,43 +1,1559 @@
-void generate_preamble(FILE *out_file)
+typedef struct Codegen_Options
 {
-	fprintf(out_file, "global _start\n");
+	// Count calls to every function and dump the counts on exit.
+	// The program writes the raw 64-bit counts (in source order) to
+	// jive.prof and the matching function names, one per line, to jive.prof.map
+	bool instrument;
+	
+	// Counts from an instrumented run (see load_profile). When set, functions
+	// are emitted hottest first, and never-called ones go to .text.cold
+	const char *profile_file_name;
+	
+	// Identical code folding: functions whose generated code is the same
+	// share one copy, and the others become aliases of it
+	bool fold_identical;
+	
+	// Lower loops the straightforward way (top tested, no strength reduction,
+	// hoisting or unrolling), mostly as a baseline to measure against
+	bool naive_loops;
+	long unroll_factor; // Copies of an innermost loop body, 0 for the default
+	
+	// Emit an object to link into a C program: no _start, and every function
+	// is global. main is then just another function
+	bool library;
+	
+	// Write out every print right away, one write syscall each, as a baseline
+	// for the buffered runtime
+	bool unbuffered_print;
+	
+	// Compare a match against each of its values in turn, never using a jump
+	// table or a decision tree, as a baseline for both
+	bool match_chains;
+} Codegen_Options;
+
+#define DEFAULT_UNROLL_FACTOR 4
+
+// Reads the counts written by an --instrument build (file_name) and its name
+// map (file_name.map) into profile_count of each function. Functions that are
+// no longer in the program are skipped, new ones are left with a count of 0
+bool load_profile(const char *file_name, Symbol_Table *fns, FILE *err_file)
+{
+	char map_file_name[1024];
+	snprintf(map_file_name, sizeof(map_file_name), "%s.map", file_name);
+	
+	long counts_size = 0;
+	unsigned long *counts = (unsigned long *)read_entire_file(file_name, &counts_size, err_file);
+	if (counts == NULL) return false;
+	
+	long map_size = 0;
+	char *map = read_entire_file(map_file_name, &map_size, err_file);
+	if (map == NULL)
+	{
+		free(counts);
+		return false;
+	}
+	
+	long count_index = 0;
+	long line_start = 0;
+	for (long i = 0; i < map_size; i++)
+	{
+		if (map[i] != '\n') continue;
+		
+		if (count_index * 8 + 8 > counts_size)
+		{
+			fprintf(err_file, "ERROR: %s has more functions than %s has counts\n", map_file_name, file_name);
+			free(counts);
+			free(map);
+			return false;
+		}
+		
+		String name = {&map[line_start], i - line_start};
+		Symbol *symbol = symbol_table_find(fns, name);
+		if (symbol != NULL)
+		{
+			symbol->node->fn.profile_count = counts[count_index];
+		}
+		
+		count_index++;
+		line_start = i + 1;
+	}
+	
+	free(counts);
+	free(map);
+	return true;
+}
+
+int compare_fns_by_profile(const void *a, const void *b)
+{
+	AST_Node *fn_a = *(AST_Node **)a;
+	AST_Node *fn_b = *(AST_Node **)b;
+	if (fn_a->fn.profile_count != fn_b->fn.profile_count)
+	{
+		return fn_a->fn.profile_count > fn_b->fn.profile_count ? -1 : 1;
+	}
+	// Keep source order among equally hot functions
+	return fn_a->fn.index < fn_b->fn.index ? -1 : fn_a->fn.index > fn_b->fn.index;
+}
+
+// Appends the function of every call made in fn_node to callees, repeats
+// included. Walks the body with an explicit stack, like free_ast
+void collect_callees(AST_Node *fn_node, AST_Node_Array *callees)
+{
+	AST_Node_Array pending = {0};
+	for (AST_Node *stmt = fn_node->fn.body.first; stmt != NULL; stmt = stmt->next)
+	{
+		ast_node_array_append(&pending, stmt);
+	}
+	
+	while (pending.count > 0)
+	{
+		AST_Node *node = pending.items[--pending.count];
+		AST_List *children = NULL;
+		switch (node->kind)
+		{
+		case AST_RETURN: if (node->ret_expr != NULL) ast_node_array_append(&pending, node->ret_expr); break;
+		case AST_PRINT:  ast_node_array_append(&pending, node->print_expr); break;
+		case AST_LET:
+		case AST_ASSIGN: ast_node_array_append(&pending, node->assign.value); break;
+		case AST_NEGATE:
+		case AST_CAST:   ast_node_array_append(&pending, node->operand); break;
+		case AST_BINARY_OP:
+			ast_node_array_append(&pending, node->binary_op.left);
+			ast_node_array_append(&pending, node->binary_op.right);
+			break;
+		case AST_CALL:
+			ast_node_array_append(callees, node->call.fn);
+			for (long i = 0; i < node->call.arg_count; i++)
+			{
+				ast_node_array_append(&pending, node->call.args[i]);
+			}
+			break;
+		case AST_WHILE:
+			ast_node_array_append(&pending, node->loop.cond);
+			children = &node->loop.body;
+			break;
+		case AST_MATCH:
+			ast_node_array_append(&pending, node->match.value);
+			for (long arm = 0; arm < node->match.arm_count; arm++)
+			{
+				for (AST_Node *child = node->match.arms[arm].first; child != NULL; child = child->next)
+				{
+					ast_node_array_append(&pending, child);
+				}
+			}
+			children = &node->match.else_body;
+			break;
+		default:
+			break;
+		}
+		
+		if (children != NULL)
+		{
+			for (AST_Node *child = children->first; child != NULL; child = child->next)
+			{
+				ast_node_array_append(&pending, child);
+			}
+		}
+	}
+	
+	free(pending.items);
+}
+
+// Lays out fns for a profiled build. Hot functions come first, and each one
+// that is called is placed right after its hottest caller, so a call and its
+// target tend to share a page. The profile only counts calls per function, so
+// the hottest caller stands in for the hottest call edge. Functions that were
+// never called go last, in source order
+void order_fns_by_profile(AST_Node **fns, long fn_count)
+{
+	qsort(fns, fn_count, sizeof(AST_Node *), compare_fns_by_profile);
+	
+	// Hot callees of each function, hottest first, indexed by fn.index.
+	// Going through callers hottest first, the first caller of a function
+	// found is its hottest one
+	AST_Node_Array *children = calloc(fn_count, sizeof(AST_Node_Array));
+	bool *has_parent = calloc(fn_count, sizeof(bool));
+	AST_Node_Array callees = {0};
+	for (long i = 0; i < fn_count && fns[i]->fn.profile_count > 0; i++)
+	{
+		callees.count = 0;
+		collect_callees(fns[i], &callees);
+		for (long j = 0; j < callees.count; j++)
+		{
+			AST_Node *callee = callees.items[j];
+			if (callee == fns[i] || callee->fn.profile_count == 0 || has_parent[callee->fn.index]) continue;
+			has_parent[callee->fn.index] = true;
+			ast_node_array_append(&children[fns[i]->fn.index], callee);
+		}
+	}
+	for (long i = 0; i < fn_count; i++)
+	{
+		AST_Node_Array *list = &children[fns[i]->fn.index];
+		qsort(list->items, list->count, sizeof(AST_Node *), compare_fns_by_profile);
+	}
+	
+	// Depth first from each function without a parent, hottest first
+	AST_Node **order = malloc(fn_count * sizeof(AST_Node *));
+	long order_count = 0;
+	AST_Node_Array pending = {0};
+	for (long i = 0; i < fn_count; i++)
+	{
+		if (has_parent[fns[i]->fn.index]) continue;
+		
+		ast_node_array_append(&pending, fns[i]);
+		while (pending.count > 0)
+		{
+			AST_Node *fn_node = pending.items[--pending.count];
+			order[order_count++] = fn_node;
+			AST_Node_Array *list = &children[fn_node->fn.index];
+			for (long j = list->count - 1; j >= 0; j--)
+			{
+				ast_node_array_append(&pending, list->items[j]);
+			}
+		}
+	}
+	memcpy(fns, order, fn_count * sizeof(AST_Node *));
+	
+	for (long i = 0; i < fn_count; i++)
+	{
+		free(children[i].items);
+	}
+	free(children);
+	free(has_parent);
+	free(callees.items);
+	free(pending.items);
+	free(order);
+}
+
+#define RUNTIME_OUT_BUFFER_SIZE 65536
+
+// Output runtime used by print. Output is collected in a 64 KiB buffer that is
+// only written to stdout when it fills up and when the program exits, so
+// printing costs no syscalls in the common case
+void generate_runtime(Codegen_Options *options, FILE *out_file)
+{
+	// __jive_flush: writes out the buffered output
+	fprintf(out_file, "__jive_flush:\n");
+	fprintf(out_file, "    mov rdx, [rel __jive_out_len]\n");
+	fprintf(out_file, "    lea rsi, [rel __jive_out_buf]\n");
+	fprintf(out_file, ".write:\n");
+	fprintf(out_file, "    test rdx, rdx\n");
+	fprintf(out_file, "    jz .done\n");
+	fprintf(out_file, "    mov rax, 1\n"); // write
+	fprintf(out_file, "    mov rdi, 1\n"); // stdout
+	fprintf(out_file, "    syscall\n");
+	fprintf(out_file, "    test rax, rax\n");
+	fprintf(out_file, "    jle .done\n"); // Drop the output on error
+	fprintf(out_file, "    add rsi, rax\n");
+	fprintf(out_file, "    sub rdx, rax\n");
+	fprintf(out_file, "    jmp .write\n");
+	fprintf(out_file, ".done:\n");
+	fprintf(out_file, "    mov qword [rel __jive_out_len], 0\n");
+	fprintf(out_file, "    ret\n");
 	fprintf(out_file, "\n");
+	
+	// __jive_print_int: appends rdi in decimal and a newline to the buffer.
+	// Digits are produced two at a time from a 00..99 lookup table, and the
+	// division by 100 is done with a multiply by its reciprocal.
+	// __jive_print_uint does the same for an unsigned rdi, and both keep the
+	// sign in rsi
+	fprintf(out_file, "__jive_print_uint:\n");
+	fprintf(out_file, "    xor esi, esi\n");
+	fprintf(out_file, "    jmp __jive_print_decimal\n");
+	fprintf(out_file, "__jive_print_int:\n");
+	fprintf(out_file, "    mov rsi, rdi\n");
+	fprintf(out_file, "__jive_print_decimal:\n");
+	fprintf(out_file, "    mov rax, [rel __jive_out_len]\n");
+	fprintf(out_file, "    cmp rax, %d - 32\n", RUNTIME_OUT_BUFFER_SIZE);
+	fprintf(out_file, "    jbe .fits\n");
+	fprintf(out_file, "    push rdi\n");
+	fprintf(out_file, "    push rsi\n");
+	fprintf(out_file, "    call __jive_flush\n");
+	fprintf(out_file, "    pop rsi\n");
+	fprintf(out_file, "    pop rdi\n");
+	fprintf(out_file, ".fits:\n");
+	fprintf(out_file, "    sub rsp, 32\n"); // Digits are built backwards from rsp + 32
+	fprintf(out_file, "    lea r8, [rsp + 31]\n");
+	fprintf(out_file, "    mov byte [r8], 10\n");
+	fprintf(out_file, "    mov rcx, rdi\n");
+	fprintf(out_file, "    test rsi, rsi\n");
+	fprintf(out_file, "    jns .positive\n");
+	fprintf(out_file, "    neg rcx\n"); // Also right for INT64_MIN, as an unsigned value
+	fprintf(out_file, ".positive:\n");
+	fprintf(out_file, "    lea r9, [rel __jive_digit_pairs]\n");
+	fprintf(out_file, "    mov r10, 0x28F5C28F5C28F5C3\n");
+	fprintf(out_file, ".pairs:\n");
+	fprintf(out_file, "    cmp rcx, 100\n");
+	fprintf(out_file, "    jb .last\n");
+	fprintf(out_file, "    mov rax, rcx\n");
+	fprintf(out_file, "    shr rax, 2\n");
+	fprintf(out_file, "    mul r10\n");
+	fprintf(out_file, "    shr rdx, 2\n"); // rdx = rcx / 100
+	fprintf(out_file, "    imul rax, rdx, 100\n");
+	fprintf(out_file, "    sub rcx, rax\n"); // rcx = rcx % 100
+	fprintf(out_file, "    movzx eax, word [r9 + rcx*2]\n");
+	fprintf(out_file, "    sub r8, 2\n");
+	fprintf(out_file, "    mov [r8], ax\n");
+	fprintf(out_file, "    mov rcx, rdx\n");
+	fprintf(out_file, "    jmp .pairs\n");
+	fprintf(out_file, ".last:\n");
+	fprintf(out_file, "    cmp rcx, 10\n");
+	fprintf(out_file, "    jb .one_digit\n");
+	fprintf(out_file, "    movzx eax, word [r9 + rcx*2]\n");
+	fprintf(out_file, "    sub r8, 2\n");
+	fprintf(out_file, "    mov [r8], ax\n");
+	fprintf(out_file, "    jmp .sign\n");
+	fprintf(out_file, ".one_digit:\n");
+	fprintf(out_file, "    add ecx, '0'\n");
+	fprintf(out_file, "    dec r8\n");
+	fprintf(out_file, "    mov [r8], cl\n");
+	fprintf(out_file, ".sign:\n");
+	fprintf(out_file, "    test rsi, rsi\n");
+	fprintf(out_file, "    jns .copy\n");
+	fprintf(out_file, "    dec r8\n");
+	fprintf(out_file, "    mov byte [r8], '-'\n");
+	fprintf(out_file, ".copy:\n");
+	// At most 22 bytes were produced and the buffer has 32 free, so copy a
+	// fixed 24 bytes instead of looping; the excess is overwritten later
+	fprintf(out_file, "    lea rcx, [rsp + 32]\n");
+	fprintf(out_file, "    sub rcx, r8\n");
+	fprintf(out_file, "    mov rdx, [rel __jive_out_len]\n");
+	fprintf(out_file, "    lea rdi, [rel __jive_out_buf]\n");
+	fprintf(out_file, "    add rdi, rdx\n");
+	fprintf(out_file, "    add rdx, rcx\n");
+	fprintf(out_file, "    mov [rel __jive_out_len], rdx\n");
+	fprintf(out_file, "    mov rax, [r8]\n");
+	fprintf(out_file, "    mov [rdi], rax\n");
+	fprintf(out_file, "    mov rax, [r8 + 8]\n");
+	fprintf(out_file, "    mov [rdi + 8], rax\n");
+	fprintf(out_file, "    mov rax, [r8 + 16]\n");
+	fprintf(out_file, "    mov [rdi + 16], rax\n");
+	fprintf(out_file, "    add rsp, 32\n");
+	if (options->unbuffered_print)
+	{
+		fprintf(out_file, "    jmp __jive_flush\n");
+	}
+	else
+	{
+		fprintf(out_file, "    ret\n");
+	}
+	fprintf(out_file, "\n");
+}
+
+void generate_runtime_data(FILE *out_file)
+{
+	fprintf(out_file, "section .bss\n");
+	fprintf(out_file, "    alignb 64\n");
+	fprintf(out_file, "__jive_out_buf:\n");
+	fprintf(out_file, "    resb %d\n", RUNTIME_OUT_BUFFER_SIZE);
+	fprintf(out_file, "__jive_out_len:\n");
+	fprintf(out_file, "    resq 1\n");
+	fprintf(out_file, "\n");
+	
+	fprintf(out_file, "section .rodata\n");
+	fprintf(out_file, "__jive_digit_pairs:\n");
+	fprintf(out_file, "    db \"");
+	for (int i = 0; i < 100; i++)
+	{
+		fprintf(out_file, "%02d", i);
+	}
+	fprintf(out_file, "\"\n");
+	fprintf(out_file, "\n");
+}
+
+void generate_preamble(AST_Node *ast, Codegen_Options *options, FILE *out_file)
+{
+	if (options->library)
+	{
+		// Every function is callable from C, and so is the flush, since there
+		// is no _start to do it on the way out
+		for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
+		{
+			fprintf(out_file, "global %.*s\n", PRINT_STRING(fn_node->fn.name));
+		}
+		fprintf(out_file, "global __jive_flush\n");
+	}
+	else
+	{
+		fprintf(out_file, "global _start\n");
+	}
+	fprintf(out_file, "\n");
+	if (options->profile_file_name != NULL)
+	{
+		// Hot functions start on their own cache line
+		fprintf(out_file, "section .text align=64\n");
+	}
+	else
+	{
+		fprintf(out_file, "section .text\n");
+	}
+	fprintf(out_file, "\n");
+	if (options->library)
+	{
+		generate_runtime(options, out_file);
+		fprintf(out_file, "section .note.GNU-stack noalloc noexec nowrite progbits\n"); // No executable stack needed
+		fprintf(out_file, "section .text\n");
+		fprintf(out_file, "\n");
+		return;
+	}
+	
 	fprintf(out_file, "_start:\n");
 	fprintf(out_file, "    call main\n");
-	fprintf(out_file, "    mov rdi, rax\n");
+	fprintf(out_file, "    push rax\n"); // Save the exit status
+	fprintf(out_file, "    call __jive_flush\n");
+	if (options->instrument)
+	{
+		fprintf(out_file, "    lea rdi, [rel __jive_prof_path]\n");
+		fprintf(out_file, "    lea rsi, [rel __jive_counts]\n");
+		fprintf(out_file, "    mov rdx, __jive_counts_size\n");
+		fprintf(out_file, "    call __jive_write_file\n");
+		fprintf(out_file, "    lea rdi, [rel __jive_map_path]\n");
+		fprintf(out_file, "    lea rsi, [rel __jive_map]\n");
+		fprintf(out_file, "    mov rdx, __jive_map_size\n");
+		fprintf(out_file, "    call __jive_write_file\n");
+	}
+	fprintf(out_file, "    pop rdi\n");
 	fprintf(out_file, "    mov rax, 60\n");
 	fprintf(out_file, "    syscall\n");
 	fprintf(out_file, "\n");
+	
+	if (options->instrument)
+	{
+		// __jive_write_file(path = rdi, buffer = rsi, size = rdx)
+		// Errors are ignored, a failed open just makes the write fail too
+		fprintf(out_file, "__jive_write_file:\n");
+		fprintf(out_file, "    push rsi\n");
+		fprintf(out_file, "    push rdx\n");
+		fprintf(out_file, "    mov rax, 2\n");   // open
+		fprintf(out_file, "    mov rsi, 577\n"); // O_WRONLY | O_CREAT | O_TRUNC
+		fprintf(out_file, "    mov rdx, 420\n"); // 0644
+		fprintf(out_file, "    syscall\n");
+		fprintf(out_file, "    pop rdx\n");
+		fprintf(out_file, "    pop rsi\n");
+		fprintf(out_file, "    mov rdi, rax\n");
+		fprintf(out_file, "    mov rax, 1\n");   // write
+		fprintf(out_file, "    syscall\n");
+		fprintf(out_file, "    mov rax, 3\n");   // close
+		fprintf(out_file, "    syscall\n");
+		fprintf(out_file, "    ret\n");
+		fprintf(out_file, "\n");
+	}
+	
+	generate_runtime(options, out_file);
+}
+
+// Emits the counter table and the name map used by an instrumented build
+void generate_instrumentation_data(AST_Node *ast, FILE *out_file)
+{
+	fprintf(out_file, "section .bss\n");
+	fprintf(out_file, "    alignb 8\n");
+	fprintf(out_file, "__jive_counts:\n");
+	fprintf(out_file, "    resq %ld\n", ast->program.count);
+	fprintf(out_file, "__jive_counts_size equ $ - __jive_counts\n");
+	fprintf(out_file, "\n");
+	
+	fprintf(out_file, "section .rodata\n");
+	fprintf(out_file, "__jive_prof_path: db \"jive.prof\", 0\n");
+	fprintf(out_file, "__jive_map_path: db \"jive.prof.map\", 0\n");
+	fprintf(out_file, "__jive_map:\n");
+	for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
+	{
+		fprintf(out_file, "    db \"%.*s\", 10\n", PRINT_STRING(fn_node->fn.name));
+	}
+	fprintf(out_file, "__jive_map_size equ $ - __jive_map\n");
+}
+
+typedef struct Expr_Frame // Progress through one node of an expression
+{
+	AST_Node *node;
+	int stage; // Which operands have been generated so far
+} Expr_Frame;
+
+typedef struct Expr_Frame_Array
+{
+	Expr_Frame *items;
+	long count;
+	long capacity;
+} Expr_Frame_Array;
+
+void expr_frame_array_append(Expr_Frame_Array *array, AST_Node *node)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Expr_Frame));
+	}
+	array->items[array->count++] = (Expr_Frame){node, 0};
+}
+
+// Values are kept in rax sign or zero extended to 64 bits, as their type
+// says. Types narrower than 64 bits are computed with 32 bit instructions,
+// which need no REX prefix and zero extend for free, and are only extended
+// again after an operation that may have wrapped around
+
+const char *rax_names[]  = {[1] = "al", [2] = "ax", [4] = "eax", [8] = "rax"};
+const char *rcx_names[]  = {[1] = "cl", [2] = "cx", [4] = "ecx", [8] = "rcx"};
+const char *rdx_names[]  = {[1] = "dl", [2] = "dx", [4] = "edx", [8] = "rdx"};
+const char *size_names[] = {[1] = "byte", [2] = "word", [4] = "dword", [8] = "qword"};
+
+// Registers a local can live in. rax, rcx and rdx are left as scratch for
+// expressions, and rdx and rcx are only ever used to pass arguments
+typedef enum Reg
+{
+	REG_NONE = 0,
+	REG_rdi, REG_rsi, REG_r8, REG_r9, REG_r10, REG_r11, // Caller-saved
+	REG_rbx, REG_r12, REG_r13, REG_r14, REG_r15,        // Callee-saved
+	REG_rdx, REG_rcx,
+	REG_COUNT,
+} Reg;
+
+#define FIRST_CALLER_SAVED_REG REG_rdi
+#define FIRST_CALLEE_SAVED_REG REG_rbx
+#define LAST_CALLEE_SAVED_REG  REG_r15
+
+const char *reg_names[REG_COUNT][9] = {
+	[REG_rdi] = {[1] = "dil",  [2] = "di",   [4] = "edi",  [8] = "rdi"},
+	[REG_rsi] = {[1] = "sil",  [2] = "si",   [4] = "esi",  [8] = "rsi"},
+	[REG_r8]  = {[1] = "r8b",  [2] = "r8w",  [4] = "r8d",  [8] = "r8"},
+	[REG_r9]  = {[1] = "r9b",  [2] = "r9w",  [4] = "r9d",  [8] = "r9"},
+	[REG_r10] = {[1] = "r10b", [2] = "r10w", [4] = "r10d", [8] = "r10"},
+	[REG_r11] = {[1] = "r11b", [2] = "r11w", [4] = "r11d", [8] = "r11"},
+	[REG_rbx] = {[1] = "bl",   [2] = "bx",   [4] = "ebx",  [8] = "rbx"},
+	[REG_r12] = {[1] = "r12b", [2] = "r12w", [4] = "r12d", [8] = "r12"},
+	[REG_r13] = {[1] = "r13b", [2] = "r13w", [4] = "r13d", [8] = "r13"},
+	[REG_r14] = {[1] = "r14b", [2] = "r14w", [4] = "r14d", [8] = "r14"},
+	[REG_r15] = {[1] = "r15b", [2] = "r15w", [4] = "r15d", [8] = "r15"},
+	[REG_rdx] = {[1] = "dl",   [2] = "dx",   [4] = "edx",  [8] = "rdx"},
+	[REG_rcx] = {[1] = "cl",   [2] = "cx",   [4] = "ecx",  [8] = "rcx"},
+};
+
+// System V passes the first six integer arguments in these
+const Reg arg_regs[MAX_PARAMS] = {REG_rdi, REG_rsi, REG_rdx, REG_rcx, REG_r8, REG_r9};
+
+// A leaf function keeps each parameter in the register it arrived in, except
+// for the third and fourth, which move out of the way of div and shifts
+const Reg leaf_param_homes[MAX_PARAMS] = {REG_rdi, REG_rsi, REG_r10, REG_r11, REG_r8, REG_r9};
+
+// Reserves stack space for a local of the given type, naturally aligned so
+// locals pack tightly, and returns its offset below the frame pointer
+long allocate_local(long *frame_size, Type type)
+{
+	long size = type_sizes[type];
+	*frame_size = (*frame_size + size + size - 1) & ~(size - 1);
+	return *frame_size;
+}
+
+typedef struct Var_Ref // A place in a function that names a local
+{
+	AST_Var_Data *var;
+	long loop_depth;
+} Var_Ref;
+
+typedef struct Var_Ref_Array
+{
+	Var_Ref *items;
+	long count;
+	long capacity;
+} Var_Ref_Array;
+
+void var_ref_array_append(Var_Ref_Array *array, AST_Var_Data *var, long loop_depth)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Var_Ref));
+	}
+	array->items[array->count++] = (Var_Ref){var, loop_depth};
+}
+
+void collect_expr_var_refs(AST_Node *expr, long loop_depth, Var_Ref_Array *refs, bool *is_leaf)
+{
+	AST_Node_Array pending = {0};
+	ast_node_array_append(&pending, expr);
+	while (pending.count > 0)
+	{
+		AST_Node *node = pending.items[--pending.count];
+		switch (node->kind)
+		{
+		case AST_VAR:
+			var_ref_array_append(refs, &node->var, loop_depth);
+			break;
+		case AST_NEGATE:
+		case AST_CAST:
+			ast_node_array_append(&pending, node->operand);
+			break;
+		case AST_BINARY_OP:
+			ast_node_array_append(&pending, node->binary_op.left);
+			ast_node_array_append(&pending, node->binary_op.right);
+			break;
+		case AST_CALL:
+			*is_leaf = false;
+			for (long i = 0; i < node->call.arg_count; i++)
+			{
+				ast_node_array_append(&pending, node->call.args[i]);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	free(pending.items);
+}
+
+typedef struct Pending_Block // A block still to be walked, and how many loops it is in
+{
+	AST_List *block;
+	long loop_depth;
+} Pending_Block;
+
+typedef struct Pending_Block_Array
+{
+	Pending_Block *items;
+	long count;
+	long capacity;
+} Pending_Block_Array;
+
+void pending_block_array_append(Pending_Block_Array *array, AST_List *block, long loop_depth)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Pending_Block));
+	}
+	array->items[array->count++] = (Pending_Block){block, loop_depth};
+}
+
+// Walks nested blocks with a worklist rather than recursion, since loops and
+// matches can nest arbitrarily deep
+void collect_block_var_refs(AST_List *body, Var_Ref_Array *refs, bool *is_leaf)
+{
+	Pending_Block_Array pending = {0};
+	pending_block_array_append(&pending, body, 0);
+	while (pending.count > 0)
+	{
+		Pending_Block block = pending.items[--pending.count];
+		long loop_depth = block.loop_depth;
+		for (AST_Node *stmt = block.block->first; stmt != NULL; stmt = stmt->next)
+		{
+			switch (stmt->kind)
+			{
+			case AST_RETURN:
+				if (stmt->ret_expr != NULL) collect_expr_var_refs(stmt->ret_expr, loop_depth, refs, is_leaf);
+				break;
+			case AST_PRINT:
+				*is_leaf = false; // The runtime is called like any other function
+				collect_expr_var_refs(stmt->print_expr, loop_depth, refs, is_leaf);
+				break;
+			case AST_LET:
+			case AST_ASSIGN:
+				var_ref_array_append(refs, &stmt->assign.var, loop_depth);
+				collect_expr_var_refs(stmt->assign.value, loop_depth, refs, is_leaf);
+				break;
+			case AST_WHILE:
+				collect_expr_var_refs(stmt->loop.cond, loop_depth + 1, refs, is_leaf);
+				pending_block_array_append(&pending, &stmt->loop.body, loop_depth + 1);
+				break;
+			case AST_CALL:
+				collect_expr_var_refs(stmt, loop_depth, refs, is_leaf);
+				break;
+			case AST_MATCH:
+				collect_expr_var_refs(stmt->match.value, loop_depth, refs, is_leaf);
+				for (long arm = 0; arm < stmt->match.arm_count; arm++)
+				{
+					pending_block_array_append(&pending, &stmt->match.arms[arm], loop_depth);
+				}
+				pending_block_array_append(&pending, &stmt->match.else_body, loop_depth);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	free(pending.items);
+}
+
+typedef struct Local_Weight
+{
+	long slot;
+	long weight;
+} Local_Weight;
+
+int compare_local_weights(const void *a, const void *b)
+{
+	const Local_Weight *left = a;
+	const Local_Weight *right = b;
+	if (left->weight != right->weight) return left->weight < right->weight ? 1 : -1;
+	return left->slot < right->slot ? -1 : left->slot > right->slot;
+}
+
+// Gives every local of fn_node a home, most used first, with uses inside
+// loops counting 8 times as much per level of nesting. A leaf function can
+// use the caller-saved registers for free. A function that calls anything
+// only has the callee-saved ones, which cost a push and a pop each. Whatever
+// is left over goes on the stack
+void allocate_locals(AST_Node *fn_node)
+{
+	AST_Fn_Data *fn = &fn_node->fn;
+	
+	Var_Ref_Array refs = {0};
+	bool is_leaf = true;
+	for (AST_Node *param = fn->parameters.first; param != NULL; param = param->next)
+	{
+		var_ref_array_append(&refs, &param->assign.var, 0);
+	}
+	collect_block_var_refs(&fn->body, &refs, &is_leaf);
+	
+	Local_Weight *weights = calloc(fn->local_count, sizeof(Local_Weight));
+	Type *types = calloc(fn->local_count, sizeof(Type));
+	Reg *homes = calloc(fn->local_count, sizeof(Reg));
+	long *offsets = calloc(fn->local_count, sizeof(long));
+	for (long slot = 0; slot < fn->local_count; slot++)
+	{
+		weights[slot].slot = slot;
+	}
+	for (long i = 0; i < refs.count; i++)
+	{
+		AST_Var_Data *var = refs.items[i].var;
+		long loop_depth = refs.items[i].loop_depth;
+		weights[var->slot].weight += 1L << (loop_depth < 10 ? 3 * loop_depth : 30);
+		types[var->slot] = var->type;
+	}
+	
+	bool used[REG_COUNT] = {0};
+	if (is_leaf)
+	{
+		long i = 0;
+		for (AST_Node *param = fn->parameters.first; param != NULL; param = param->next, i++)
+		{
+			homes[param->assign.var.slot] = leaf_param_homes[i];
+			used[leaf_param_homes[i]] = true;
+		}
+	}
+	
+	qsort(weights, fn->local_count, sizeof(Local_Weight), compare_local_weights);
+	for (long i = 0; i < fn->local_count; i++)
+	{
+		long slot = weights[i].slot;
+		if (homes[slot] != REG_NONE) continue;
+		for (Reg reg = is_leaf ? FIRST_CALLER_SAVED_REG : FIRST_CALLEE_SAVED_REG; reg <= LAST_CALLEE_SAVED_REG; reg++)
+		{
+			if (!used[reg])
+			{
+				homes[slot] = reg;
+				used[reg] = true;
+				break;
+			}
+		}
+	}
+	
+	long frame_size = 0;
+	for (long slot = 0; slot < fn->local_count; slot++)
+	{
+		if (homes[slot] == REG_NONE) offsets[slot] = allocate_local(&frame_size, types[slot]);
+	}
+	for (long i = 0; i < refs.count; i++)
+	{
+		AST_Var_Data *var = refs.items[i].var;
+		var->home_reg = homes[var->slot];
+		var->offset = offsets[var->slot];
+	}
+	
+	fn->is_leaf = is_leaf;
+	fn->saved_regs = 0;
+	long pushed = 8; // The return address
+	for (Reg reg = FIRST_CALLEE_SAVED_REG; reg <= LAST_CALLEE_SAVED_REG; reg++)
+	{
+		if (used[reg])
+		{
+			fn->saved_regs |= 1u << reg;
+			pushed += 8;
+		}
+	}
+	fn->has_frame = frame_size > 0;
+	fn->frame_size = frame_size;
+	
+	// Calls need rsp 16 byte aligned. A leaf function with no frame leaves rsp
+	// alone, which leaves it with no prologue at all
+	if (fn->has_frame)
+	{
+		pushed += 8;
+		fn->stack_reserve = ((frame_size + pushed + 15) & ~15L) - pushed;
+	}
+	else
+	{
+		fn->stack_reserve = is_leaf ? 0 : pushed % 16;
+	}
+	
+	free(refs.items);
+	free(weights);
+	free(types);
+	free(homes);
+	free(offsets);
+}
+
+// Untyped expressions are computed as i64
+Type expr_type(AST_Node *node)
+{
+	return node->value_type != TYPE_NONE ? node->value_type : TYPE_i64;
+}
+
+// The type a binary operator computes in, which for comparisons is the type
+// of their operands rather than of their 0 or 1 result
+Type binary_op_type(AST_Node *node)
+{
+	if (node->value_type != TYPE_NONE) return node->value_type;
+	AST_Node *left = node->binary_op.left;
+	return expr_type(left->value_type != TYPE_NONE ? left : node->binary_op.right);
+}
+
+long op_size(Type type)
+{
+	return type_sizes[type] == 8 ? 8 : 4;
+}
+
+// Wraps value around to the range of type
+long truncate_to_type(long value, Type type)
+{
+	long bits = 8 * type_sizes[type];
+	if (bits == 64) return value;
+	
+	unsigned long mask = (1UL << bits) - 1;
+	unsigned long low = (unsigned long)value & mask;
+	if (type_is_signed[type] && (low >> (bits - 1)) != 0)
+	{
+		return (long)(low | ~mask);
+	}
+	return (long)low;
+}
+
+bool fits_in_imm32(long value)
+{
+	return value >= -2147483648L && value <= 2147483647L;
+}
+
+void generate_asm_for_extend(Type type, FILE *out_file)
+{
+	bool is_signed = type_is_signed[type];
+	switch (type_sizes[type])
+	{
+	case 1: fprintf(out_file, "    %s\n", is_signed ? "movsx rax, al" : "movzx eax, al"); break;
+	case 2: fprintf(out_file, "    %s\n", is_signed ? "movsx rax, ax" : "movzx eax, ax"); break;
+	case 4: if (is_signed) fprintf(out_file, "    movsxd rax, eax\n"); break;
+	}
+}
+
+// Nothing to do when every value of from is also a value of to, since it is
+// already extended correctly. Otherwise the low bits are extended as to says
+void generate_asm_for_cast(Type from, Type to, FILE *out_file)
+{
+	long from_size = type_sizes[from];
+	long to_size = type_sizes[to];
+	bool fits = type_is_signed[from] ? type_is_signed[to] && from_size <= to_size :
+		from_size < to_size || (from_size == to_size && !type_is_signed[to]);
+	if (fits) return;
+	
+	if (to == TYPE_u32)
+	{
+		fprintf(out_file, "    mov eax, eax\n");
+	}
+	else
+	{
+		generate_asm_for_extend(to, out_file);
+	}
+}
+
+// mov eax, imm32 is 5 bytes and zero extends, mov rax, imm32 is 7 and sign
+// extends, and only other values need the 10 byte imm64 form
+void generate_asm_for_integer(long value, FILE *out_file)
+{
+	if (value >= 0 && value <= 0xFFFFFFFFL)
+	{
+		fprintf(out_file, "    mov eax, %ld\n", value);
+	}
+	else
+	{
+		fprintf(out_file, "    mov rax, %ld\n", value);
+	}
+}
+
+// Locals in registers are kept extended to 64 bits like values in rax, so
+// they load with a plain mov, and can be used at any operation size
+void generate_asm_for_load(AST_Var_Data *var, FILE *out_file)
+{
+	if (var->home_reg != REG_NONE)
+	{
+		fprintf(out_file, "    mov rax, %s\n", reg_names[var->home_reg][8]);
+		return;
+	}
+	
+	const char *size_name = size_names[type_sizes[var->type]];
+	bool is_signed = type_is_signed[var->type];
+	switch (type_sizes[var->type])
+	{
+	case 1:
+	case 2:
+		fprintf(out_file, "    %s %s, %s [rbp - %ld]\n", is_signed ? "movsx" : "movzx", is_signed ? "rax" : "eax", size_name, var->offset);
+		break;
+	case 4:
+		fprintf(out_file, "    %s %s, dword [rbp - %ld]\n", is_signed ? "movsxd" : "mov", is_signed ? "rax" : "eax", var->offset);
+		break;
+	default:
+		fprintf(out_file, "    mov rax, qword [rbp - %ld]\n", var->offset);
+		break;
+	}
+}
+
+// A local or a constant that fits in an immediate can be used directly as the
+// right operand of an instruction, without computing it into a register
+// first. Narrow locals on the stack are loaded into ecx, since they don't
+// match the 32 bit operation size
+bool format_direct_operand(AST_Node *node, Type type, char *operand, long operand_size, FILE *out_file)
+{
+	long size = op_size(type);
+	if (node->kind == AST_INTEGER)
+	{
+		long value = truncate_to_type(node->int_value, type);
+		if (size == 8 && !fits_in_imm32(value)) return false;
+		snprintf(operand, operand_size, "%ld", size == 8 ? value : (long)(int)value);
+		return true;
+	}
+	if (node->kind == AST_VAR && node->var.home_reg != REG_NONE)
+	{
+		snprintf(operand, operand_size, "%s", reg_names[node->var.home_reg][size]);
+		return true;
+	}
+	if (node->kind == AST_VAR && type_sizes[node->var.type] == size)
+	{
+		snprintf(operand, operand_size, "%s [rbp - %ld]", size_names[size], node->var.offset);
+		return true;
+	}
+	if (node->kind == AST_VAR && type_sizes[node->var.type] < size)
+	{
+		bool is_signed = type_is_signed[node->var.type];
+		fprintf(out_file, "    %s ecx, %s [rbp - %ld]\n", is_signed ? "movsx" : "movzx",
+		        size_names[type_sizes[node->var.type]], node->var.offset);
+		snprintf(operand, operand_size, "ecx");
+		return true;
+	}
+	return false;
+}
+
+// Condition code suffix for a comparison operator, NULL for anything else
+const char *condition_code(Token_Kind op, bool negate, bool is_signed)
+{
+	switch ((int)op)
+	{
+	case '<':      return negate ? (is_signed ? "ge" : "ae") : (is_signed ? "l"  : "b");
+	case '>':      return negate ? (is_signed ? "le" : "be") : (is_signed ? "g"  : "a");
+	case TOKEN_LE: return negate ? (is_signed ? "g"  : "a")  : (is_signed ? "le" : "be");
+	case TOKEN_GE: return negate ? (is_signed ? "l"  : "b")  : (is_signed ? "ge" : "ae");
+	case TOKEN_EQ: return negate ? "ne" : "e";
+	case TOKEN_NE: return negate ? "e"  : "ne";
+	default:       return NULL;
+	}
+}
+
+// rax = rax op operand, computed in type
+bool generate_asm_for_binary_op(Token_Kind op, Type type, const char *operand, FILE *out_file, FILE *err_file)
+{
+	long size = op_size(type);
+	const char *rax = rax_names[size];
+	const char *rcx = rcx_names[size];
+	bool is_immediate = operand[0] == '-' || isdigit(operand[0]);
+	
+	switch ((int)op)
+	{
+	case '+': fprintf(out_file, "    add %s, %s\n", rax, operand); break;
+	case '-': fprintf(out_file, "    sub %s, %s\n", rax, operand); break;
+	case '*':
+		if (is_immediate)
+		{
+			fprintf(out_file, "    imul %s, %s, %s\n", rax, rax, operand);
+		}
+		else
+		{
+			fprintf(out_file, "    imul %s, %s\n", rax, operand);
+		}
+		break;
+	case '/':
+	case '%':
+		if (strcmp(operand, rcx) != 0)
+		{
+			fprintf(out_file, "    mov %s, %s\n", rcx, operand);
+		}
+		if (type_is_signed[type])
+		{
+			fprintf(out_file, "    %s\n", size == 8 ? "cqo" : "cdq");
+			fprintf(out_file, "    idiv %s\n", rcx);
+		}
+		else
+		{
+			fprintf(out_file, "    xor edx, edx\n");
+			fprintf(out_file, "    div %s\n", rcx);
+		}
+		if (op == '%')
+		{
+			fprintf(out_file, "    mov %s, %s\n", rax, rdx_names[size]);
+		}
+		break;
+	default: {
+		const char *cc = condition_code(op, false, type_is_signed[type]);
+		if (cc == NULL)
+		{
+			fprintf(err_file, "ERROR: Unhandled binary operator ");
+			print_token_kind(err_file, op);
+			fprintf(err_file, " in code generation\n");
+			return false;
+		}
+		fprintf(out_file, "    cmp %s, %s\n", rax, operand);
+		fprintf(out_file, "    set%s al\n", cc);
+		fprintf(out_file, "    movzx eax, al\n");
+		return true;
+	}
+	}
+	
+	generate_asm_for_extend(type, out_file);
+	return true;
+}
+
+// Moves the arguments into their registers and calls. The last argument is
+// still in rax and the others were pushed in order. pushed counts the 8 byte
+// pushes since the statement started, to keep the call 16 byte aligned
+void generate_asm_for_call(AST_Node *call, long pushed, FILE *out_file)
+{
+	long arg_count = call->call.arg_count;
+	if (arg_count > 0)
+	{
+		fprintf(out_file, "    mov %s, rax\n", reg_names[arg_regs[arg_count - 1]][8]);
+		for (long i = arg_count - 2; i >= 0; i--)
+		{
+			fprintf(out_file, "    pop %s\n", reg_names[arg_regs[i]][8]);
+			pushed--;
+		}
+	}
+	
+	if (pushed % 2 != 0)
+	{
+		fprintf(out_file, "    sub rsp, 8\n");
+		fprintf(out_file, "    call %.*s\n", PRINT_STRING(call->call.name));
+		fprintf(out_file, "    add rsp, 8\n");
+	}
+	else
+	{
+		fprintf(out_file, "    call %.*s\n", PRINT_STRING(call->call.name));
+	}
 }
 
-// Helper function to generate asm for an expression
-bool generate_asm_for_expr(AST_Node *expr, FILE *out_file)
+// Helper function to generate asm for an expression. The result ends up in
+// rax. Walks the tree with an explicit stack, like parse_expression, so deep
+// nesting can't overflow the C stack. pushed is how many values the caller
+// already has on the stack
+bool generate_asm_for_expr(AST_Node *expr, long pushed, FILE *out_file, FILE *err_file)
 {
 	if (expr == NULL)
 	{
-		printf("ERROR: NULL expression in code generation\n");
+		fprintf(err_file, "ERROR: NULL expression in code generation\n");
 		return false;
 	}
 	
-	switch (expr->kind)
+	Expr_Frame_Array frames = {0};
+	expr_frame_array_append(&frames, expr);
+	
+	bool success = true;
+	while (frames.count > 0 && success)
+	{
+		Expr_Frame *frame = &frames.items[frames.count - 1];
+		AST_Node *node = frame->node;
+		char operand[64];
+		
+		switch (node->kind)
+		{
+		case AST_INTEGER:
+			// Load the integer value into rax
+			generate_asm_for_integer(truncate_to_type(node->int_value, expr_type(node)), out_file);
+			frames.count--;
+			break;
+		
+		case AST_VAR:
+			generate_asm_for_load(&node->var, out_file);
+			frames.count--;
+			break;
+		
+		case AST_NEGATE:
+			if (frame->stage++ == 0)
+			{
+				expr_frame_array_append(&frames, node->operand);
+			}
+			else
+			{
+				fprintf(out_file, "    neg %s\n", rax_names[op_size(expr_type(node))]);
+				generate_asm_for_extend(expr_type(node), out_file);
+				frames.count--;
+			}
+			break;
+		
+		case AST_CAST:
+			if (frame->stage++ == 0)
+			{
+				expr_frame_array_append(&frames, node->operand);
+			}
+			else
+			{
+				generate_asm_for_cast(expr_type(node->operand), node->value_type, out_file);
+				frames.count--;
+			}
+			break;
+		
+		case AST_BINARY_OP: {
+			Type type = binary_op_type(node);
+			AST_Node *left = node->binary_op.left;
+			AST_Node *right = node->binary_op.right;
+			if (frame->stage == 0 && left->kind == AST_VAR && left->var.home_reg != REG_NONE &&
+			    right->kind != AST_INTEGER && right->kind != AST_VAR)
+			{
+				// Nothing in an expression can change a local, so one in a register
+				// can wait there while the right value is computed
+				frame->stage = 3;
+				expr_frame_array_append(&frames, right);
+			}
+			else if (frame->stage == 0)
+			{
+				frame->stage = 1;
+				expr_frame_array_append(&frames, left);
+			}
+			else if (frame->stage == 3)
+			{
+				long size = op_size(type);
+				fprintf(out_file, "    mov %s, %s\n", rcx_names[size], rax_names[size]);
+				fprintf(out_file, "    mov rax, %s\n", reg_names[left->var.home_reg][8]);
+				success = generate_asm_for_binary_op(node->binary_op.op, type, rcx_names[size], out_file, err_file);
+				frames.count--;
+			}
+			else if (frame->stage == 1 && format_direct_operand(node->binary_op.right, type, operand, sizeof(operand), out_file))
+			{
+				success = generate_asm_for_binary_op(node->binary_op.op, type, operand, out_file, err_file);
+				frames.count--;
+			}
+			else if (frame->stage == 1)
+			{
+				// Keep the left value on the stack while the right one is computed
+				fprintf(out_file, "    push rax\n");
+				pushed++;
+				frame->stage = 2;
+				expr_frame_array_append(&frames, node->binary_op.right);
+			}
+			else
+			{
+				long size = op_size(type);
+				fprintf(out_file, "    mov %s, %s\n", rcx_names[size], rax_names[size]);
+				fprintf(out_file, "    pop rax\n");
+				pushed--;
+				success = generate_asm_for_binary_op(node->binary_op.op, type, rcx_names[size], out_file, err_file);
+				frames.count--;
+			}
+			break;
+		}
+		
+		case AST_CALL: {
+			// Arguments are computed left to right, each but the last waiting
+			// on the stack while the next one is computed
+			long arg_count = node->call.arg_count;
+			if (frame->stage > 0 && frame->stage < arg_count)
+			{
+				fprintf(out_file, "    push rax\n");
+				pushed++;
+			}
+			if (frame->stage < arg_count)
+			{
+				long arg = frame->stage++;
+				expr_frame_array_append(&frames, node->call.args[arg]);
+			}
+			else
+			{
+				generate_asm_for_call(node, pushed, out_file);
+				pushed -= arg_count > 0 ? arg_count - 1 : 0;
+				frames.count--;
+			}
+			break;
+		}
+		
+		default:
+			fprintf(err_file, "ERROR: Unhandled expression kind %s in code generation\n", ast_kind_as_cstr(node->kind));
+			success = false;
+			break;
+		}
+	}
+	
+	free(frames.items);
+	return success;
+}
+
+// Jumps to label when cond is true (or false, if jump_if is false). A
+// comparison becomes a cmp feeding the conditional jump directly, instead of
+// materializing a 0 or 1 and testing it
+bool generate_asm_for_cond(AST_Node *cond, bool jump_if, const char *label, long index, FILE *out_file, FILE *err_file)
+{
+	Type type = cond->kind == AST_BINARY_OP ? binary_op_type(cond) : expr_type(cond);
+	const char *cc = cond->kind == AST_BINARY_OP ? condition_code(cond->binary_op.op, !jump_if, type_is_signed[type]) : NULL;
+	if (cc == NULL)
+	{
+		bool success = generate_asm_for_expr(cond, 0, out_file, err_file);
+		if (!success) return false;
+		fprintf(out_file, "    test rax, rax\n");
+		fprintf(out_file, "    j%s .loop%ld_%s\n", jump_if ? "nz" : "z", index, label);
+		return true;
+	}
+	
+	long size = op_size(type);
+	char operand[64];
+	
+	// A local in a register is compared in place
+	AST_Node *left = cond->binary_op.left;
+	if (left->kind == AST_VAR && left->var.home_reg != REG_NONE &&
+	    format_direct_operand(cond->binary_op.right, type, operand, sizeof(operand), out_file))
 	{
-	case AST_INTEGER:
-		// Load the integer value into rax
-		fprintf(out_file, "    mov rax, %ld\n", expr->int_value);
+		fprintf(out_file, "    cmp %s, %s\n", reg_names[left->var.home_reg][size], operand);
+		fprintf(out_file, "    j%s .loop%ld_%s\n", cc, index, label);
 		return true;
+	}
 	
-	default:
-		printf("ERROR: Unhandled expression kind %s in code generation\n", ast_kind_as_cstr(expr->kind));
-		return false;
+	bool success = generate_asm_for_expr(left, 0, out_file, err_file);
+	if (!success) return false;
+	
+	if (!format_direct_operand(cond->binary_op.right, type, operand, sizeof(operand), out_file))
+	{
+		fprintf(out_file, "    push rax\n");
+		success = generate_asm_for_expr(cond->binary_op.right, 1, out_file, err_file);
+		if (!success) return false;
+		fprintf(out_file, "    mov %s, %s\n", rcx_names[size], rax_names[size]);
+		fprintf(out_file, "    pop rax\n");
+		snprintf(operand, sizeof(operand), "%s", rcx_names[size]);
+	}
+	fprintf(out_file, "    cmp %s, %s\n", rax_names[size], operand);
+	fprintf(out_file, "    j%s .loop%ld_%s\n", cc, index, label);
+	return true;
+}
+
+// Loops and matches have labels of their own, which copies of an unrolled
+// body would repeat
+bool block_has_labels(AST_List *block)
+{
+	for (AST_Node *stmt = block->first; stmt != NULL; stmt = stmt->next)
+	{
+		if (stmt->kind == AST_WHILE || stmt->kind == AST_MATCH) return true;
+	}
+	return false;
+}
+
+// Everything before the first copy of a loop's body, which is emitted
+// unroll_factor times with generate_asm_for_loop_copy between the copies, and
+// followed by generate_asm_for_loop_end
+bool generate_asm_for_loop_start(AST_Node *loop, Codegen_Options *options, long *unroll_factor, FILE *out_file, FILE *err_file)
+{
+	long index = loop->loop.index;
+	
+	if (options->naive_loops)
+	{
+		// Top tested, with the condition computed as a value: two branches per iteration
+		*unroll_factor = 1;
+		fprintf(out_file, ".loop%ld_head:\n", index);
+		bool success = generate_asm_for_expr(loop->loop.cond, 0, out_file, err_file);
+		if (!success) return false;
+		fprintf(out_file, "    test rax, rax\n");
+		fprintf(out_file, "    jz .loop%ld_end\n", index);
+		return true;
+	}
+	
+	// Bottom tested: the guard runs once, then each iteration ends in one
+	// compare and a taken branch back to an aligned loop header. Innermost loops
+	// are unrolled, with a not-taken exit test between the copies of the body
+	*unroll_factor = options->unroll_factor > 0 ? options->unroll_factor : DEFAULT_UNROLL_FACTOR;
+	if (block_has_labels(&loop->loop.body))
+	{
+		*unroll_factor = 1;
+	}
+	
+	bool success = generate_asm_for_cond(loop->loop.cond, false, "end", index, out_file, err_file);
+	if (!success) return false;
+	fprintf(out_file, "    align 16\n");
+	fprintf(out_file, ".loop%ld_body:\n", index);
+	return true;
+}
+
+bool generate_asm_for_loop_copy(AST_Node *loop, FILE *out_file, FILE *err_file)
+{
+	return generate_asm_for_cond(loop->loop.cond, false, "end", loop->loop.index, out_file, err_file);
+}
+
+bool generate_asm_for_loop_end(AST_Node *loop, Codegen_Options *options, FILE *out_file, FILE *err_file)
+{
+	long index = loop->loop.index;
+	if (options->naive_loops)
+	{
+		fprintf(out_file, "    jmp .loop%ld_head\n", index);
+	}
+	else
+	{
+		bool success = generate_asm_for_cond(loop->loop.cond, true, "body", index, out_file, err_file);
+		if (!success) return false;
+	}
+	fprintf(out_file, ".loop%ld_end:\n", index);
+	return true;
+}
+
+// Matches with this many cases or fewer compare against each value in turn.
+// Bigger ones use a jump table when at least a third of its entries would be
+// filled, and a binary search over the sorted values otherwise
+#define MATCH_MAX_CHAIN_CASES  3
+#define MATCH_MIN_TABLE_DENSITY 3
+#define MATCH_MAX_TABLE_SIZE   65536
+
+// cmp rax, value, with the matched value in rax
+void generate_asm_for_case_cmp(long value, FILE *out_file)
+{
+	if (fits_in_imm32(value))
+	{
+		fprintf(out_file, "    cmp rax, %ld\n", value);
+	}
+	else
+	{
+		fprintf(out_file, "    mov rcx, %ld\n", value);
+		fprintf(out_file, "    cmp rax, rcx\n");
+	}
+}
+
+// Compares against cases [lo, hi) one by one
+void generate_asm_for_match_chain(AST_Match_Data *match, long lo, long hi, FILE *out_file)
+{
+	for (long i = lo; i < hi; i++)
+	{
+		generate_asm_for_case_cmp(match->cases[i].value, out_file);
+		fprintf(out_file, "    je .match%ld_arm%ld\n", match->index, match->cases[i].arm);
+	}
+	fprintf(out_file, "    jmp .match%ld_else\n", match->index);
+}
+
+// Decision tree over cases [lo, hi): each node tests its middle value for a
+// match, then goes left or right, so any value is found in O(log n) compares.
+// The last few values of each branch are compared one by one
+void generate_asm_for_match_tree(AST_Match_Data *match, long lo, long hi, bool is_signed, long *node_count, FILE *out_file)
+{
+	long index = match->index;
+	if (hi - lo <= MATCH_MAX_CHAIN_CASES)
+	{
+		generate_asm_for_match_chain(match, lo, hi, out_file);
+		return;
+	}
+	
+	long mid = lo + (hi - lo) / 2;
+	long node = (*node_count)++;
+	generate_asm_for_case_cmp(match->cases[mid].value, out_file);
+	fprintf(out_file, "    je .match%ld_arm%ld\n", index, match->cases[mid].arm);
+	fprintf(out_file, "    j%s .match%ld_node%ld\n", is_signed ? "l" : "b", index, node);
+	generate_asm_for_match_tree(match, mid + 1, hi, is_signed, node_count, out_file);
+	fprintf(out_file, ".match%ld_node%ld:\n", index, node);
+	generate_asm_for_match_tree(match, lo, mid, is_signed, node_count, out_file);
+}
+
+// Jumps to the arm stmt's value selects. The arms follow, see
+// generate_asm_for_match_arm. Values are compared as the canonical 64 bit
+// rax, which orders every type the way the type itself does, as long as u64
+// compares unsigned
+bool generate_asm_for_match(AST_Node *stmt, Codegen_Options *options, FILE *out_file, FILE *err_file)
+{
+	AST_Match_Data *match = &stmt->match;
+	long index = match->index;
+	long case_count = match->case_count;
+	
+	bool success = generate_asm_for_expr(match->value, 0, out_file, err_file);
+	if (!success) return false;
+	
+	// Entries - 1, computed unsigned so it can't overflow for any type
+	unsigned long span = case_count > 0 ? (unsigned long)match->cases[case_count - 1].value - (unsigned long)match->cases[0].value : 0;
+	
+	if (options->match_chains)
+	{
+		generate_asm_for_match_chain(match, 0, case_count, out_file);
+	}
+	else if (case_count > MATCH_MAX_CHAIN_CASES && span < MATCH_MAX_TABLE_SIZE &&
+	         span < (unsigned long)case_count * MATCH_MIN_TABLE_DENSITY)
+	{
+		// One unsigned compare rejects values on both sides of the table. The
+		// table is absolute addresses, so library builds, which may be linked
+		// position independent, put it in .data.rel.ro for the dynamic linker
+		long min = match->cases[0].value;
+		if (min != 0 && fits_in_imm32(min))
+		{
+			fprintf(out_file, "    sub rax, %ld\n", min);
+		}
+		else if (min != 0)
+		{
+			fprintf(out_file, "    mov rcx, %ld\n", min);
+			fprintf(out_file, "    sub rax, rcx\n");
+		}
+		fprintf(out_file, "    cmp rax, %lu\n", span);
+		fprintf(out_file, "    ja .match%ld_else\n", index);
+		fprintf(out_file, "    lea rcx, [rel .match%ld_table]\n", index);
+		fprintf(out_file, "    jmp qword [rcx + rax*8]\n");
+		
+		fprintf(out_file, "[section %s]\n", options->library ? ".data.rel.ro progbits alloc noexec write align=8" : ".rodata");
+		fprintf(out_file, "    align 8\n");
+		fprintf(out_file, ".match%ld_table:\n", index);
+		long next_case = 0;
+		for (unsigned long entry = 0; entry <= span; entry++)
+		{
+			long value = (long)((unsigned long)min + entry);
+			if (match->cases[next_case].value == value)
+			{
+				fprintf(out_file, "    dq .match%ld_arm%ld\n", index, match->cases[next_case++].arm);
+			}
+			else
+			{
+				fprintf(out_file, "    dq .match%ld_else\n", index);
+			}
+		}
+		fprintf(out_file, "__SECT__\n");
+	}
+	else
+	{
+		long node_count = 0;
+		bool is_signed = type_is_signed[expr_type(match->value)];
+		generate_asm_for_match_tree(match, 0, case_count, is_signed, &node_count, out_file);
+	}
+	return true;
+}
+
+// The label of arm, or of the else arm when arm is arm_count. Returns the
+// arm's body. Every arm but the else one ends with a jump to .matchN_end
+AST_List *generate_asm_for_match_arm(AST_Node *stmt, long arm, FILE *out_file)
+{
+	AST_Match_Data *match = &stmt->match;
+	if (arm < match->arm_count)
+	{
+		fprintf(out_file, ".match%ld_arm%ld:\n", match->index, arm);
+		return &match->arms[arm];
+	}
+	fprintf(out_file, ".match%ld_else:\n", match->index);
+	return &match->else_body;
+}
+
+// Pushes the callee-saved registers fn_node uses, sets up its frame, and
+// moves the parameters from their argument registers to their homes
+void generate_asm_for_prologue(AST_Node *fn_node, FILE *out_file)
+{
+	AST_Fn_Data *fn = &fn_node->fn;
+	for (Reg reg = FIRST_CALLEE_SAVED_REG; reg <= LAST_CALLEE_SAVED_REG; reg++)
+	{
+		if (fn->saved_regs & (1u << reg)) fprintf(out_file, "    push %s\n", reg_names[reg][8]);
+	}
+	if (fn->has_frame)
+	{
+		fprintf(out_file, "    push rbp\n");
+		fprintf(out_file, "    mov rbp, rsp\n");
+	}
+	if (fn->stack_reserve > 0)
+	{
+		fprintf(out_file, "    sub rsp, %ld\n", fn->stack_reserve);
+	}
+	
+	// System V leaves the bits above a narrow argument undefined, so they are
+	// extended here, as the type says
+	long i = 0;
+	for (AST_Node *param = fn->parameters.first; param != NULL; param = param->next, i++)
+	{
+		AST_Var_Data *var = &param->assign.var;
+		long size = type_sizes[var->type];
+		bool is_signed = type_is_signed[var->type];
+		const char *const *from = reg_names[arg_regs[i]];
+		if (var->home_reg == REG_NONE)
+		{
+			fprintf(out_file, "    mov %s [rbp - %ld], %s\n", size_names[size], var->offset, from[size]);
+			continue;
+		}
+		
+		const char *const *to = reg_names[var->home_reg];
+		switch (size)
+		{
+		case 1:
+		case 2:
+			fprintf(out_file, "    %s %s, %s\n", is_signed ? "movsx" : "movzx", to[is_signed ? 8 : 4], from[size]);
+			break;
+		case 4:
+			fprintf(out_file, "    %s %s, %s\n", is_signed ? "movsxd" : "mov", to[is_signed ? 8 : 4], from[4]);
+			break;
+		default:
+			if (var->home_reg != arg_regs[i]) fprintf(out_file, "    mov %s, %s\n", to[8], from[8]);
+			break;
+		}
+	}
+}
+
+void generate_asm_for_epilogue(AST_Node *fn_node, FILE *out_file)
+{
+	AST_Fn_Data *fn = &fn_node->fn;
+	if (fn->has_frame)
+	{
+		fprintf(out_file, "    leave\n");
+	}
+	else if (fn->stack_reserve > 0)
+	{
+		fprintf(out_file, "    add rsp, %ld\n", fn->stack_reserve);
+	}
+	for (Reg reg = LAST_CALLEE_SAVED_REG; reg >= FIRST_CALLEE_SAVED_REG; reg--)
+	{
+		if (fn->saved_regs & (1u << reg)) fprintf(out_file, "    pop %s\n", reg_names[reg][8]);
+	}
+	fprintf(out_file, "    ret\n");
+}
+
+// Assignment to a local that lives in a register
+bool generate_asm_for_reg_assign(AST_Var_Data *var, AST_Node *value, FILE *out_file, FILE *err_file)
+{
+	const char *const *names = reg_names[var->home_reg];
+	
+	// x = constant and x = x +/- constant update the register directly. Only
+	// 64 bit and u32 arithmetic keeps the register extended correctly by itself
+	if (value->kind == AST_INTEGER)
+	{
+		long constant = truncate_to_type(value->int_value, var->type);
+		if (constant >= 0 && constant <= 0xFFFFFFFFL)
+		{
+			fprintf(out_file, "    mov %s, %ld\n", names[4], constant);
+		}
+		else
+		{
+			fprintf(out_file, "    mov %s, %ld\n", names[8], constant);
+		}
+		return true;
+	}
+	if (value->kind == AST_BINARY_OP && (value->binary_op.op == '+' || value->binary_op.op == '-') &&
+	    value->binary_op.left->kind == AST_VAR && value->binary_op.left->var.slot == var->slot &&
+	    value->binary_op.right->kind == AST_INTEGER && (type_sizes[var->type] == 8 || var->type == TYPE_u32))
+	{
+		long size = op_size(var->type);
+		long constant = truncate_to_type(value->binary_op.right->int_value, var->type);
+		if (size == 4 || fits_in_imm32(constant))
+		{
+			fprintf(out_file, "    %s %s, %ld\n", value->binary_op.op == '+' ? "add" : "sub", names[size],
+			        size == 8 ? constant : (long)(int)constant);
+			return true;
+		}
 	}
+	
+	// Extended to the variable's type, like a store to the stack narrows it
+	bool success = generate_asm_for_expr(value, 0, out_file, err_file);
+	if (!success) return false;
+	generate_asm_for_cast(expr_type(value), var->type, out_file);
+	fprintf(out_file, "    mov %s, rax\n", names[8]);
+	return true;
 }
 
 // Helper function to generate asm for a statement
-bool generate_asm_for_stmt(AST_Node *stmt, FILE *out_file)
+bool generate_asm_for_stmt(AST_Node *stmt, AST_Node *fn_node, Codegen_Options *options, FILE *out_file, FILE *err_file)
 {
 	if (stmt == NULL)
 	{
-		printf("ERROR: NULL statement in code generation\n");
+		fprintf(err_file, "ERROR: NULL statement in code generation\n");
 		return false;
 	}
 	
@@ -47,20 +1563,186 @@ bool generate_asm_for_stmt(AST_Node *stmt, FILE *out_file)
 		if (stmt->ret_expr != NULL)
 		{
 			// Generate code for the return expression
-			bool success = generate_asm_for_expr(stmt->ret_expr, out_file);
+			bool success = generate_asm_for_expr(stmt->ret_expr, 0, out_file, err_file);
 			if (!success) return false;
 		}
 		// Return from the function (rax already contains the return value)
-		fprintf(out_file, "    ret\n");
+		generate_asm_for_epilogue(fn_node, out_file);
 		return true;
 	
+	case AST_PRINT: {
+		bool success = generate_asm_for_expr(stmt->print_expr, 0, out_file, err_file);
+		if (!success) return false;
+		fprintf(out_file, "    mov rdi, rax\n");
+		fprintf(out_file, "    call %s\n", expr_type(stmt->print_expr) == TYPE_u64 ? "__jive_print_uint" : "__jive_print_int");
+		return true;
+	}
+	
+	case AST_LET:
+	case AST_ASSIGN: {
+		AST_Var_Data *var = &stmt->assign.var;
+		long size = type_sizes[var->type];
+		AST_Node *value = stmt->assign.value;
+		
+		if (var->home_reg != REG_NONE)
+		{
+			return generate_asm_for_reg_assign(var, value, out_file, err_file);
+		}
+		
+		// x = constant and x = x +/- constant update memory directly
+		if (value->kind == AST_INTEGER)
+		{
+			long constant = truncate_to_type(value->int_value, var->type);
+			if (size < 8 || fits_in_imm32(constant))
+			{
+				fprintf(out_file, "    mov %s [rbp - %ld], %ld\n", size_names[size], var->offset, constant);
+				return true;
+			}
+		}
+		if (value->kind == AST_BINARY_OP && (value->binary_op.op == '+' || value->binary_op.op == '-') &&
+		    value->binary_op.left->kind == AST_VAR && value->binary_op.left->var.slot == var->slot &&
+		    value->binary_op.right->kind == AST_INTEGER)
+		{
+			long constant = truncate_to_type(value->binary_op.right->int_value, var->type);
+			if (size < 8 || fits_in_imm32(constant))
+			{
+				fprintf(out_file, "    %s %s [rbp - %ld], %ld\n", value->binary_op.op == '+' ? "add" : "sub",
+				        size_names[size], var->offset, constant);
+				return true;
+			}
+		}
+		
+		bool success = generate_asm_for_expr(value, 0, out_file, err_file);
+		if (!success) return false;
+		fprintf(out_file, "    mov %s [rbp - %ld], %s\n", size_names[size], var->offset, rax_names[size]);
+		return true;
+	}
+	
+	case AST_CALL:
+		return generate_asm_for_expr(stmt, 0, out_file, err_file);
+	
 	default:
-		printf("ERROR: Unhandled statement kind %s in code generation\n", ast_kind_as_cstr(stmt->kind));
+		fprintf(err_file, "ERROR: Unhandled statement kind %s in code generation\n", ast_kind_as_cstr(stmt->kind));
 		return false;
 	}
 }
 
-bool generate_asm_for_fn(AST_Node *fn_node, FILE *out_file)
+typedef struct Stmt_Frame // Progress through one block
+{
+	AST_Node *owner; // The loop or match this block belongs to, NULL for the function body
+	AST_Node *next;  // The next statement to generate
+	long part;       // Which copy of an unrolled loop body, or which match arm, this is
+	long unroll_factor;
+} Stmt_Frame;
+
+typedef struct Stmt_Frame_Array
+{
+	Stmt_Frame *items;
+	long count;
+	long capacity;
+} Stmt_Frame_Array;
+
+void stmt_frame_array_append(Stmt_Frame_Array *array, Stmt_Frame frame)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Stmt_Frame));
+	}
+	array->items[array->count++] = frame;
+}
+
+// Generates the statements of block, and the loops and matches nested in it.
+// Nested blocks are kept on an explicit stack rather than recursed into, so
+// deeply nested input can't overflow the compiler's stack
+bool generate_asm_for_block(AST_List *block, AST_Node *fn_node, Codegen_Options *options, FILE *out_file, FILE *err_file)
+{
+	Stmt_Frame_Array frames = {0};
+	stmt_frame_array_append(&frames, (Stmt_Frame){NULL, block->first, 0, 1});
+	bool success = true;
+	
+	while (success && frames.count > 0)
+	{
+		Stmt_Frame *frame = &frames.items[frames.count - 1];
+		AST_Node *stmt = frame->next;
+		if (stmt != NULL)
+		{
+			frame->next = stmt->next;
+			if (stmt->kind == AST_WHILE)
+			{
+				long unroll_factor = 1;
+				success = generate_asm_for_loop_start(stmt, options, &unroll_factor, out_file, err_file);
+				stmt_frame_array_append(&frames, (Stmt_Frame){stmt, stmt->loop.body.first, 0, unroll_factor});
+			}
+			else if (stmt->kind == AST_MATCH)
+			{
+				success = generate_asm_for_match(stmt, options, out_file, err_file);
+				AST_List *arm_body = generate_asm_for_match_arm(stmt, 0, out_file);
+				stmt_frame_array_append(&frames, (Stmt_Frame){stmt, arm_body->first, 0, 1});
+			}
+			else
+			{
+				success = generate_asm_for_stmt(stmt, fn_node, options, out_file, err_file);
+			}
+			continue;
+		}
+		
+		// The end of a block. A loop body goes again for each copy, and a match
+		// goes on to its next arm
+		AST_Node *owner = frame->owner;
+		if (owner != NULL && owner->kind == AST_WHILE)
+		{
+			if (++frame->part < frame->unroll_factor)
+			{
+				success = generate_asm_for_loop_copy(owner, out_file, err_file);
+				frame->next = owner->loop.body.first;
+				continue;
+			}
+			success = generate_asm_for_loop_end(owner, options, out_file, err_file);
+		}
+		else if (owner != NULL && owner->kind == AST_MATCH)
+		{
+			if (frame->part < owner->match.arm_count)
+			{
+				fprintf(out_file, "    jmp .match%ld_end\n", owner->match.index);
+				AST_List *arm_body = generate_asm_for_match_arm(owner, ++frame->part, out_file);
+				frame->next = arm_body->first;
+				continue;
+			}
+			fprintf(out_file, ".match%ld_end:\n", owner->match.index);
+		}
+		frames.count--;
+	}
+	
+	free(frames.items);
+	return success;
+}
+
+// Everything after the function's label: the code that identical code folding
+// compares between functions
+bool generate_asm_for_fn_body(AST_Node *fn_node, Codegen_Options *options, FILE *out_file, FILE *err_file)
+{
+	if (options->instrument)
+	{
+		fprintf(out_file, "    inc qword [rel __jive_counts + %ld]\n", 8 * fn_node->fn.index);
+	}
+	
+	generate_asm_for_prologue(fn_node, out_file);
+	
+	// Iterate over the body of the function
+	bool success = generate_asm_for_block(&fn_node->fn.body, fn_node, options, out_file, err_file);
+	if (!success) return false;
+	
+	// Falling off the end returns too
+	AST_Node *last = fn_node->fn.body.last;
+	if (last == NULL || last->kind != AST_RETURN)
+	{
+		generate_asm_for_epilogue(fn_node, out_file);
+	}
+	return true;
+}
+
+bool generate_asm_for_fn(AST_Node *fn_node, Codegen_Options *options, FILE *out_file, FILE *err_file)
 {
 	// TODO: Implement this
 	// TODO: Print the function name as a label
@@ -72,39 +1754,194 @@ bool generate_asm_for_fn(AST_Node *fn_node, FILE *out_file)
 	
 	if (fn_node == NULL || fn_node->kind != AST_FN)
 	{
-		printf("ERROR: Expected function node in generate_asm_for_fn\n");
+		fprintf(err_file, "ERROR: Expected function node in generate_asm_for_fn\n");
 		return false;
 	}
 	
 	// Print the function name as a label
 	fprintf(out_file, "%.*s:\n", PRINT_STRING(fn_node->fn.name));
 	
-	// Iterate over the body of the function
-	for (AST_Node *stmt = fn_node->fn.body.first; stmt != NULL; stmt = stmt->next)
-	{
-		bool success = generate_asm_for_stmt(stmt, out_file);
-		if (!success) return false;
-	}
+	bool success = generate_asm_for_fn_body(fn_node, options, out_file, err_file);
+	if (!success) return false;
 	
 	fprintf(out_file, "\n");
 	
 	return true;
 }
 
-bool generate_asm(AST_Node *ast, FILE *out_file)
+// Identical code folding: lowers every function body, and points each
+// function whose body matches an earlier one (in emission order) at that
+// function through fn.folded_into. The earlier function also chains all of its
+// aliases through fn.next_alias. Returns the lowered bodies, indexed like fns
+char **fold_identical_fns(AST_Node **fns, long fn_count, Codegen_Options *options, FILE *err_file)
+{
+	char **bodies = calloc(fn_count, sizeof(char *));
+	Symbol_Table unique_bodies = {0};
+	symbol_table_reserve(&unique_bodies, fn_count);
+	
+	// What folding removes is measured in asm text, not in encoded bytes
+	long folded_count = 0;
+	long folded_lines = 0;
+	long folded_chars = 0;
+	for (long i = 0; i < fn_count; i++)
+	{
+		fns[i]->fn.folded_into = NULL;
+		fns[i]->fn.next_alias = NULL;
+	}
+	
+	for (long i = 0; i < fn_count; i++)
+	{
+		size_t body_len = 0;
+		FILE *body_file = open_memstream(&bodies[i], &body_len);
+		bool success = generate_asm_for_fn_body(fns[i], options, body_file, err_file);
+		fclose(body_file);
+		if (!success)
+		{
+			for (long j = 0; j <= i; j++) free(bodies[j]);
+			free(bodies);
+			free(unique_bodies.items);
+			return NULL;
+		}
+		
+		Symbol *existing = symbol_table_insert(&unique_bodies, (String){bodies[i], body_len}, (Loc){0}, fns[i]);
+		if (existing != NULL)
+		{
+			AST_Node *shared = existing->node;
+			fns[i]->fn.folded_into = shared;
+			fns[i]->fn.next_alias = shared->fn.next_alias;
+			shared->fn.next_alias = fns[i];
+			folded_count++;
+			for (size_t c = 0; c < body_len; c++)
+			{
+				if (bodies[i][c] == '\n') folded_lines++;
+			}
+			folded_chars += body_len;
+		}
+	}
+	
+	fprintf(err_file, "NOTE: Folded %ld identical functions, %ld asm lines (%ld chars)\n", folded_count, folded_lines, folded_chars);
+	
+	free(unique_bodies.items);
+	return bodies;
+}
+
+bool generate_asm(AST_Node *ast, Codegen_Options *options, FILE *out_file, FILE *err_file)
 {
 	if (ast == NULL || ast->kind != AST_PROGRAM)
 	{
-		printf("ERROR: Root AST node was not PROGRAM. Got kind %s\n", ast_kind_as_cstr(ast->kind));
+		fprintf(err_file, "ERROR: Root AST node was not PROGRAM. Got kind %s\n", ast_kind_as_cstr(ast->kind));
+		return false;
+	}
+	
+	if (options->library && options->instrument)
+	{
+		fprintf(err_file, "ERROR: --instrument needs the _start of a program, and can't be used with --library\n");
 		return false;
 	}
+	if (!options->library)
+	{
+		// _start calls main, so a missing one is caught here rather than by the linker
+		AST_Node *main_fn = NULL;
+		for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
+		{
+			if (str_equal(fn_node->fn.name, str_lit("main"))) main_fn = fn_node;
+		}
+		if (main_fn == NULL)
+		{
+			fprintf(err_file, "ERROR: No main function defined\n");
+			return false;
+		}
+		if (main_fn->fn.parameters.count > 0)
+		{
+			fprintf(err_file, "ERROR: main can't take parameters\n");
+			return false;
+		}
+	}
+	
+	if (!options->naive_loops)
+	{
+		optimize_loops(ast);
+	}
+	for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
+	{
+		allocate_locals(fn_node);
+	}
 	
-	generate_preamble(out_file);
+	generate_preamble(ast, options, out_file);
 	
+	// Functions in the order they are emitted
+	AST_Node **fns = malloc(ast->program.count * sizeof(AST_Node *));
+	long fn_count = 0;
 	for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
 	{
-		bool success = generate_asm_for_fn(fn_node, out_file);
-		if (!success) return false;
+		fns[fn_count++] = fn_node;
+	}
+	
+	if (options->profile_file_name != NULL)
+	{
+		// Pack the hot functions together, so they share as few cache lines and
+		// pages as possible, and move the rest out of the way
+		order_fns_by_profile(fns, fn_count);
+	}
+	
+	char **bodies = NULL;
+	if (options->fold_identical)
+	{
+		bodies = fold_identical_fns(fns, fn_count, options, err_file);
+		if (bodies == NULL)
+		{
+			free(fns);
+			return false;
+		}
+	}
+	
+	bool success = true;
+	bool in_cold_section = false;
+	for (long i = 0; i < fn_count && success; i++)
+	{
+		if (options->profile_file_name != NULL)
+		{
+			if (fns[i]->fn.profile_count == 0 && !in_cold_section)
+			{
+				fprintf(out_file, "section .text.cold progbits alloc exec nowrite align=16\n");
+				fprintf(out_file, "\n");
+				in_cold_section = true;
+			}
+			if (!in_cold_section && (bodies == NULL || fns[i]->fn.folded_into == NULL))
+			{
+				fprintf(out_file, "    align 64\n");
+			}
+		}
+		
+		if (bodies == NULL)
+		{
+			success = generate_asm_for_fn(fns[i], options, out_file, err_file);
+		}
+		else if (fns[i]->fn.folded_into == NULL) // Folded functions were emitted as extra labels
+		{
+			fprintf(out_file, "%.*s:\n", PRINT_STRING(fns[i]->fn.name));
+			for (AST_Node *alias = fns[i]->fn.next_alias; alias != NULL; alias = alias->fn.next_alias)
+			{
+				fprintf(out_file, "%.*s:\n", PRINT_STRING(alias->fn.name));
+			}
+			fputs(bodies[i], out_file);
+			fprintf(out_file, "\n");
+		}
+	}
+	
+	if (bodies != NULL)
+	{
+		for (long i = 0; i < fn_count; i++) free(bodies[i]);
+		free(bodies);
+	}
+	free(fns);
+	if (!success) return false;
+	
+	generate_runtime_data(out_file);
+	
+	if (options->instrument)
+	{
+		generate_instrumentation_data(ast, out_file);
 	}
 	
 	return true;
@@ -0,0 +1,37 @@
+#pragma once
+
+// Embeddable compiler API. Every call works only on its own arguments and
+// the memory it allocates, so separate compilations can run concurrently on
+// different threads.
+
+#include <stdbool.h>
+
+#define JIVE_API __attribute__((visibility("default")))
+
+typedef struct Jive_Options
+{
+	bool instrument;               // Same as --instrument
+	const char *profile_file_name; // Same as --profile-use=file, or NULL
+	bool fold_identical;           // Same as --fold-identical
+	bool naive_loops;              // Same as --naive-loops
+	long unroll_factor;            // Same as --unroll=n, 0 for the default
+	bool library;                  // Same as --library
+	bool unbuffered_print;         // Same as --unbuffered-print
+	bool match_chains;             // Same as --match-chains
+} Jive_Options;
+
+// Everything returned is owned by the caller, release it with jive_free_result
+typedef struct Jive_Result
+{
+	bool success;
+	char *asm_text;      // NASM source, NUL terminated. NULL on failure
+	long asm_len;
+	char *diagnostics;   // Errors as the command line compiler prints them, NUL terminated
+	long diagnostics_len;
+} Jive_Result;
+
+// Compiles source_len bytes of source. The source does not need to be NUL
+// terminated, and file_name is only used in diagnostics
+JIVE_API Jive_Result jive_compile(const char *file_name, const char *source, long source_len, const Jive_Options *options);
+
+JIVE_API void jive_free_result(Jive_Result *result);
@@ -7,6 +7,11 @@ typedef enum Token_Kind
 	TOKEN_KEYWORD,
 	TOKEN_TYPE,
 	TOKEN_ARROW, // ->
+	TOKEN_FAT_ARROW, // =>
+	TOKEN_LE,    // <=
+	TOKEN_GE,    // >=
+	TOKEN_EQ,    // ==
+	TOKEN_NE,    // !=
 	
 	// Single character tokens (ASCII values)
 	// We can use the character itself as the token kind
@@ -18,6 +23,12 @@ typedef enum Keyword
 	KEYWORD_NONE = 0,
 	KEYWORD_fn,
 	KEYWORD_return,
+	KEYWORD_print,
+	KEYWORD_let,
+	KEYWORD_while,
+	KEYWORD_as,
+	KEYWORD_match,
+	KEYWORD_else,
 	// Add more keywords as needed
 } Keyword;
 
@@ -25,20 +36,63 @@ const String keyword_names[] = {
 	[KEYWORD_NONE]   = str_lit("NONE"),
 	[KEYWORD_fn]     = str_lit("fn"),
 	[KEYWORD_return] = str_lit("return"),
+	[KEYWORD_print]  = str_lit("print"),
+	[KEYWORD_let]    = str_lit("let"),
+	[KEYWORD_while]  = str_lit("while"),
+	[KEYWORD_as]     = str_lit("as"),
+	[KEYWORD_match]  = str_lit("match"),
+	[KEYWORD_else]   = str_lit("else"),
 };
 
 typedef enum Type
 {
-	TYPE_NONE = 0,
-	TYPE_int,
+	TYPE_NONE = 0, // Also the type of untyped constants, until context gives them one
+	TYPE_int,      // Same as i64
+	TYPE_i8,
+	TYPE_i16,
+	TYPE_i32,
+	TYPE_i64,
+	TYPE_u8,
+	TYPE_u16,
+	TYPE_u32,
+	TYPE_u64,
 	// Add more types as needed
 } Type;
 
 const String type_names[] = {
 	[TYPE_NONE] = str_lit("NONE"),
 	[TYPE_int]  = str_lit("int"),
+	[TYPE_i8]   = str_lit("i8"),
+	[TYPE_i16]  = str_lit("i16"),
+	[TYPE_i32]  = str_lit("i32"),
+	[TYPE_i64]  = str_lit("i64"),
+	[TYPE_u8]   = str_lit("u8"),
+	[TYPE_u16]  = str_lit("u16"),
+	[TYPE_u32]  = str_lit("u32"),
+	[TYPE_u64]  = str_lit("u64"),
 };
 
+// Storage size in bytes
+const long type_sizes[] = {
+	[TYPE_int] = 8,
+	[TYPE_i8]  = 1, [TYPE_i16] = 2, [TYPE_i32] = 4, [TYPE_i64] = 8,
+	[TYPE_u8]  = 1, [TYPE_u16] = 2, [TYPE_u32] = 4, [TYPE_u64] = 8,
+};
+
+const bool type_is_signed[] = {
+	[TYPE_int] = true,
+	[TYPE_i8]  = true,  [TYPE_i16] = true,  [TYPE_i32] = true,  [TYPE_i64] = true,
+	[TYPE_u8]  = false, [TYPE_u16] = false, [TYPE_u32] = false, [TYPE_u64] = false,
+};
+
+// Largest value of a type, as an unsigned number
+unsigned long type_max(Type type)
+{
+	unsigned long bits = 8 * type_sizes[type];
+	unsigned long max = bits == 64 ? ~0UL : (1UL << bits) - 1;
+	return type_is_signed[type] ? max >> 1 : max;
+}
+
 typedef struct Loc
 {
 	const char *file_name;
@@ -56,7 +110,11 @@ typedef struct Token
 	{
 		Keyword keyword; // For TOKEN_KEYWORD
 		Type type;       // For TOKEN_TYPE
-		long int_value;  // For TOKEN_INTEGER
+		struct           // For TOKEN_INTEGER
+		{
+			long int_value; // Two's complement bits, for u64 values past INT64_MAX
+			Type int_type;  // From a suffix like 200u8, TYPE_NONE if there is none
+		};
 	};
 } Token;
 
@@ -67,48 +125,53 @@ typedef struct Token_Array
 	long capacity;
 } Token_Array;
 
-void print_loc(Loc loc)
+void print_loc(FILE *file, Loc loc)
 {
-	printf("%s:%ld:%ld", loc.file_name, loc.line, loc.column);
+	fprintf(file, "%s:%ld:%ld", loc.file_name, loc.line, loc.column);
 }
 
-void print_token_kind(Token_Kind kind)
+void print_token_kind(FILE *file, Token_Kind kind)
 {
 	switch (kind)
 	{
-	case TOKEN_NONE:    printf("NONE"); break;
-	case TOKEN_EOF:     printf("EOF"); break;
-	case TOKEN_IDENT:   printf("IDENT"); break;
-	case TOKEN_INTEGER: printf("INTEGER"); break;
-	case TOKEN_KEYWORD: printf("KEYWORD"); break;
-	case TOKEN_TYPE:    printf("TYPE"); break;
-	case TOKEN_ARROW:   printf("ARROW"); break;
+	case TOKEN_NONE:    fprintf(file, "NONE"); break;
+	case TOKEN_EOF:     fprintf(file, "EOF"); break;
+	case TOKEN_IDENT:   fprintf(file, "IDENT"); break;
+	case TOKEN_INTEGER: fprintf(file, "INTEGER"); break;
+	case TOKEN_KEYWORD: fprintf(file, "KEYWORD"); break;
+	case TOKEN_TYPE:    fprintf(file, "TYPE"); break;
+	case TOKEN_ARROW:   fprintf(file, "ARROW"); break;
+	case TOKEN_FAT_ARROW: fprintf(file, "'=>'"); break;
+	case TOKEN_LE:      fprintf(file, "'<='"); break;
+	case TOKEN_GE:      fprintf(file, "'>='"); break;
+	case TOKEN_EQ:      fprintf(file, "'=='"); break;
+	case TOKEN_NE:      fprintf(file, "'!='"); break;
 	default:
 		if (kind < 128 && isprint(kind))
 		{
-			printf("'%c'", (char)kind);
+			fprintf(file, "'%c'", (char)kind);
 		}
 		else
 		{
-			printf("UNKNOWN(%d)", kind);
+			fprintf(file, "UNKNOWN(%d)", kind);
 		}
 		break;
 	}
 }
 
-void print_token(Token *tok)
+void print_token(FILE *file, Token *tok)
 {
-	print_loc(tok->loc);
-	printf(": ");
-	print_token_kind(tok->kind);
-	printf(" '%.*s'", PRINT_STRING(tok->text));
+	print_loc(file, tok->loc);
+	fprintf(file, ": ");
+	print_token_kind(file, tok->kind);
+	fprintf(file, " '%.*s'", PRINT_STRING(tok->text));
 }
 
 void print_token_array(Token_Array tokens)
 {
 	for (long i = 0; i < tokens.count; i++)
 	{
-		print_token(&tokens.items[i]);
+		print_token(stdout, &tokens.items[i]);
 		printf("\n");
 	}
 }
@@ -121,6 +184,7 @@ typedef struct Lexer
 	long pos;
 	long line;
 	long column;
+	FILE *err_file; // Where diagnostics go
 	
 	Token_Array tokens;
 } Lexer;
@@ -237,8 +301,27 @@ void lex_source(Lexer *lexer)
 		long start_pos = lexer->pos;
 		long start_column = lexer->column;
 		
+		// Two character comparisons <= >= == !=
+		if ((c == '<' || c == '>' || c == '=' || c == '!') && peek_char(lexer, 1) == '=')
+		{
+			advance_char(lexer);
+			advance_char(lexer);
+			Token_Kind kind = c == '<' ? TOKEN_LE : c == '>' ? TOKEN_GE : c == '=' ? TOKEN_EQ : TOKEN_NE;
+			Token tok = make_token(lexer, kind, start_pos, start_column);
+			token_array_append(&lexer->tokens, tok);
+		}
+		// Fat arrow => between the values of a match arm and its body
+		else if (c == '=' && peek_char(lexer, 1) == '>')
+		{
+			advance_char(lexer);
+			advance_char(lexer);
+			Token tok = make_token(lexer, TOKEN_FAT_ARROW, start_pos, start_column);
+			token_array_append(&lexer->tokens, tok);
+		}
 		// Single character tokens
-		if (c == '(' || c == ')' || c == '{' || c == '}' || c == ',')
+		else if (c == '(' || c == ')' || c == '{' || c == '}' || c == ',' || c == ':' ||
+		    c == '+' || c == '*' || c == '/' || c == '%' ||
+		    c == '<' || c == '>' || c == '=')
 		{
 			advance_char(lexer);
 			Token tok = make_token(lexer, (Token_Kind)c, start_pos, start_column);
@@ -252,20 +335,54 @@ void lex_source(Lexer *lexer)
 			Token tok = make_token(lexer, TOKEN_ARROW, start_pos, start_column);
 			token_array_append(&lexer->tokens, tok);
 		}
-		// Numbers
+		// Minus, once we know it isn't an arrow
+		else if (c == '-')
+		{
+			advance_char(lexer);
+			Token tok = make_token(lexer, (Token_Kind)c, start_pos, start_column);
+			token_array_append(&lexer->tokens, tok);
+		}
+		// Numbers, with an optional type suffix
 		else if (isdigit(c))
 		{
+			unsigned long value = 0;
+			bool overflow = false;
 			while (isdigit(peek_char(lexer, 0)))
+			{
+				unsigned long digit = advance_char(lexer) - '0';
+				overflow = overflow || value > (~0UL - digit) / 10;
+				value = value * 10 + digit;
+			}
+			long suffix_pos = lexer->pos;
+			while (isalnum(peek_char(lexer, 0)) || peek_char(lexer, 0) == '_')
 			{
 				advance_char(lexer);
 			}
 			Token tok = make_token(lexer, TOKEN_INTEGER, start_pos, start_column);
+			tok.int_value = (long)value;
 			
-			// Parse the integer value
-			tok.int_value = 0;
-			for (long i = 0; i < tok.text.count; i++)
+			// Unsuffixed literals are i64 unless context says otherwise, which the
+			// parser checks once it knows the type
+			String suffix = {&lexer->source[suffix_pos], lexer->pos - suffix_pos};
+			Type limit_type = TYPE_i64;
+			if (suffix.count > 0)
 			{
-				tok.int_value = tok.int_value * 10 + (tok.text.data[i] - '0');
+				tok.int_type = match_type(suffix);
+				limit_type = tok.int_type;
+				if (tok.int_type == TYPE_NONE || tok.int_type == TYPE_int)
+				{
+					print_loc(lexer->err_file, tok.loc);
+					fprintf(lexer->err_file, ": ERROR: Invalid integer literal suffix %.*s\n", PRINT_STRING(suffix));
+					tok.kind = TOKEN_NONE; // The parser stops here without another error
+				}
+			}
+			if (tok.kind == TOKEN_INTEGER && (overflow || value > type_max(limit_type)))
+			{
+				print_loc(lexer->err_file, tok.loc);
+				fprintf(lexer->err_file, ": ERROR: Integer literal %.*s is out of range for %.*s",
+				        PRINT_STRING(tok.text), PRINT_STRING(type_names[limit_type]));
+				fprintf(lexer->err_file, "%s\n", suffix.count == 0 && !overflow ? " (use a u64 suffix for larger values)" : "");
+				tok.kind = TOKEN_NONE;
 			}
 			
 			token_array_append(&lexer->tokens, tok);
@@ -301,9 +418,9 @@ void lex_source(Lexer *lexer)
 		}
 		else
 		{
-			printf("ERROR: Unexpected character '%c' at ", c);
-			print_loc((Loc){lexer->file_name, lexer->line, lexer->column});
-			printf("\n");
+			fprintf(lexer->err_file, "ERROR: Unexpected character '%c' at ", c);
+			print_loc(lexer->err_file, (Loc){lexer->file_name, lexer->line, lexer->column});
+			fprintf(lexer->err_file, "\n");
 			advance_char(lexer);
 		}
 	}
@@ -319,34 +436,17 @@ void lex_source(Lexer *lexer)
 	token_array_append(&lexer->tokens, eof_tok);
 }
 
-Token_Array lex_file(const char *file_name)
+// Tokens point into source, so it has to outlive them
+Token_Array lex_buffer(const char *file_name, char *source, long source_len, FILE *err_file)
 {
-	// Read the file
-	FILE *file = fopen(file_name, "r");
-	if (!file)
-	{
-		printf("ERROR: Could not open file %s\n", file_name);
-		return (Token_Array){0};
-	}
-	
-	fseek(file, 0, SEEK_END);
-	long file_size = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	
-	char *source = malloc(file_size + 1);
-	fread(source, 1, file_size, file);
-	source[file_size] = '\0';
-	
-	fclose(file);
-	
-	// Lex the source
 	Lexer lexer = {
 		.file_name = file_name,
 		.source = source,
-		.source_len = file_size,
+		.source_len = source_len,
 		.pos = 0,
 		.line = 1,
 		.column = 1,
+		.err_file = err_file,
 	};
 	
 	lex_source(&lexer);
@@ -354,3 +454,18 @@ Token_Array lex_file(const char *file_name)
 	return lexer.tokens;
 }
 
+// Returns false if the file can't be read
+bool lex_file(const char *file_name, Token_Array *tokens, FILE *err_file)
+{
+	// Read the file
+	long file_size = 0;
+	char *source = read_entire_file(file_name, &file_size, err_file);
+	if (source == NULL)
+	{
+		return false;
+	}
+	
+	// Lex the source
+	*tokens = lex_buffer(file_name, source, file_size, err_file);
+	return true;
+}
\ No newline at end of file
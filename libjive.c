@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "jive.h"
+
+// This is set up for unity build
+#include "string.c"
+#include "lexer.c"
+#include "parser.c"
+#include "optimize.c"
+#include "codegen.c"
+
+Jive_Result jive_compile(const char *file_name, const char *source, long source_len, const Jive_Options *options)
+{
+	Jive_Result result = {0};
+	
+	size_t diagnostics_len = 0;
+	FILE *err_file = open_memstream(&result.diagnostics, &diagnostics_len);
+	
+	// Tokens point into the source, so keep it alive until we're done
+	Token_Array tokens = lex_buffer(file_name, (char *)source, source_len, err_file);
+	Parse_Result parse_result = parse_program(tokens, err_file);
+	
+	Codegen_Options codegen = {
+		.instrument = options != NULL && options->instrument,
+		.profile_file_name = options != NULL ? options->profile_file_name : NULL,
+		.fold_identical = options != NULL && options->fold_identical,
+		.naive_loops = options != NULL && options->naive_loops,
+		.unroll_factor = options != NULL ? options->unroll_factor : 0,
+		.library = options != NULL && options->library,
+		.unbuffered_print = options != NULL && options->unbuffered_print,
+		.match_chains = options != NULL && options->match_chains,
+	};
+	
+	bool success = parse_result.success;
+	if (success && codegen.profile_file_name != NULL)
+	{
+		success = load_profile(codegen.profile_file_name, &parse_result.fns, err_file);
+	}
+	
+	if (success)
+	{
+		size_t asm_len = 0;
+		FILE *out_file = open_memstream(&result.asm_text, &asm_len);
+		success = generate_asm(parse_result.ast, &codegen, out_file, err_file);
+		fclose(out_file);
+		result.asm_len = asm_len;
+		
+		if (!success)
+		{
+			free(result.asm_text);
+			result.asm_text = NULL;
+			result.asm_len = 0;
+		}
+	}
+	
+	free_ast(parse_result.ast);
+	free(parse_result.fns.items);
+	free(tokens.items);
+	
+	fclose(err_file);
+	result.diagnostics_len = diagnostics_len;
+	result.success = success;
+	return result;
+}
+
+void jive_free_result(Jive_Result *result)
+{
+	free(result->asm_text);
+	free(result->diagnostics);
+	*result = (Jive_Result){0};
+}
@@ -0,0 +1,109 @@
+// Throughput benchmark for repeated in-process compiles through libjive.
+//
+//   gcc -O2 -fvisibility=hidden -c libjive.c -o libjive_hidden.o
+//   objcopy --localize-hidden libjive_hidden.o libjive.o
+//   gcc -O2 libjive_bench.c libjive.o -lpthread -o libjive_bench
+//   ./libjive_bench [threads] [compiles_per_thread] [input.jive]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "jive.h"
+
+const char default_source[] =
+	"fn main() -> int { return 42 }\n"
+	"fn foo() -> int { return (1 + 2) * 3 - 4 / 2 }\n"
+	"fn bar() -> int { print 123 return -17 % 5 }\n"
+	"fn baz() -> int { return 17 }\n";
+
+typedef struct Bench_Thread
+{
+	pthread_t thread;
+	const char *source;
+	long source_len;
+	long compiles;
+	long failures;
+	long asm_bytes;
+} Bench_Thread;
+
+void *run_bench_thread(void *arg)
+{
+	Bench_Thread *bench = arg;
+	for (long i = 0; i < bench->compiles; i++)
+	{
+		Jive_Result result = jive_compile("bench.jive", bench->source, bench->source_len, NULL);
+		if (!result.success) bench->failures++;
+		bench->asm_bytes += result.asm_len;
+		jive_free_result(&result);
+	}
+	return NULL;
+}
+
+double seconds_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int main(int arg_count, const char **args)
+{
+	long thread_count = arg_count > 1 ? atol(args[1]) : 1;
+	long compiles = arg_count > 2 ? atol(args[2]) : 100000;
+	
+	const char *source = default_source;
+	long source_len = sizeof(default_source) - 1;
+	if (arg_count > 3)
+	{
+		FILE *file = fopen(args[3], "rb");
+		if (!file)
+		{
+			printf("ERROR: Could not open file %s\n", args[3]);
+			return 1;
+		}
+		fseek(file, 0, SEEK_END);
+		source_len = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		char *data = malloc(source_len);
+		fread(data, 1, source_len, file);
+		fclose(file);
+		source = data;
+	}
+	
+	if (thread_count < 1) thread_count = 1;
+	Bench_Thread *threads = calloc(thread_count, sizeof(Bench_Thread));
+	
+	double start = seconds_now();
+	for (long i = 0; i < thread_count; i++)
+	{
+		threads[i].source = source;
+		threads[i].source_len = source_len;
+		threads[i].compiles = compiles;
+		pthread_create(&threads[i].thread, NULL, run_bench_thread, &threads[i]);
+	}
+	
+	long failures = 0;
+	long asm_bytes = 0;
+	for (long i = 0; i < thread_count; i++)
+	{
+		pthread_join(threads[i].thread, NULL);
+		failures += threads[i].failures;
+		asm_bytes += threads[i].asm_bytes;
+	}
+	double elapsed = seconds_now() - start;
+	
+	long total = thread_count * compiles;
+	printf("%ld threads x %ld compiles in %.3f s\n", thread_count, compiles, elapsed);
+	printf("%.0f compiles/s, %.1f MB/s of source in, %.1f MB/s of asm out\n",
+	       total / elapsed, total * (double)source_len / elapsed / 1e6, asm_bytes / elapsed / 1e6);
+	if (failures > 0)
+	{
+		printf("ERROR: %ld compiles failed\n", failures);
+		return 1;
+	}
+	
+	return 0;
+}
@@ -1,24 +1,28 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include <ctype.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <sys/un.h>
 
 // This is set up for unity build
-#include "string.c"
-#include "lexer.c"
-#include "parser.c"
-#include "codegen.c"
+#include "libjive.c"
+#include "watch.c"
 
 typedef struct Options
 {
 	const char *out_file_name;
 	const char *in_file_name;
+	const char *watch_dir_name;
+	const char *socket_name;
+	Codegen_Options codegen;
 } Options;
 
 void print_usage(const char *program_name)
 {
-	printf("Usage: %s input_file.jive [-o output_file.asm]\n", program_name);
+	printf("Usage: %s input_file.jive [-o output_file.asm] [--instrument] [--profile-use=file] [--fold-identical] [--unroll=n] [--naive-loops] [--library] [--unbuffered-print] [--match-chains]\n", program_name);
+	printf("       %s --watch dir [--socket=path] [--instrument] [--profile-use=file] [--fold-identical] [--unroll=n] [--naive-loops] [--library] [--unbuffered-print] [--match-chains]\n", program_name);
 }
 
 int main(int arg_count, const char **args)
@@ -50,6 +54,59 @@ int main(int arg_count, const char **args)
 				return 1; // Exit with error
 			}
 		}
+		else if (strcmp(arg, "--watch") == 0) // Stay resident and recompile dir on changes
+		{
+			if (arg_index < arg_count)
+			{
+				options.watch_dir_name = args[arg_index++];
+			}
+			else
+			{
+				printf("ERROR: Missing directory after --watch flag.\n");
+				return 1; // Exit with error
+			}
+		}
+		else if (strncmp(arg, "--socket=", strlen("--socket=")) == 0) // Where --watch listens for compile requests
+		{
+			options.socket_name = arg + strlen("--socket=");
+		}
+		else if (strcmp(arg, "--instrument") == 0) // Count function calls at runtime
+		{
+			options.codegen.instrument = true;
+		}
+		else if (strcmp(arg, "--fold-identical") == 0) // Share code between identical functions
+		{
+			options.codegen.fold_identical = true;
+		}
+		else if (strcmp(arg, "--naive-loops") == 0) // Skip loop optimizations
+		{
+			options.codegen.naive_loops = true;
+		}
+		else if (strcmp(arg, "--library") == 0) // Object to link into a C program, no _start
+		{
+			options.codegen.library = true;
+		}
+		else if (strcmp(arg, "--unbuffered-print") == 0) // One write syscall per print
+		{
+			options.codegen.unbuffered_print = true;
+		}
+		else if (strcmp(arg, "--match-chains") == 0) // Compare chains for every match
+		{
+			options.codegen.match_chains = true;
+		}
+		else if (strncmp(arg, "--unroll=", strlen("--unroll=")) == 0) // Copies of each innermost loop body
+		{
+			options.codegen.unroll_factor = atol(arg + strlen("--unroll="));
+			if (options.codegen.unroll_factor < 1)
+			{
+				printf("ERROR: --unroll needs a factor of at least 1.\n");
+				return 1; // Exit with error
+			}
+		}
+		else if (strncmp(arg, "--profile-use=", strlen("--profile-use=")) == 0) // Lay out code using counts from --instrument
+		{
+			options.codegen.profile_file_name = arg + strlen("--profile-use=");
+		}
 		else if (options.in_file_name == NULL) // If no flag, set input file name
 		{
 			options.in_file_name = arg;
@@ -60,6 +117,11 @@ int main(int arg_count, const char **args)
 		}
 	}
 	
+	if (options.watch_dir_name != NULL)
+	{
+		return watch_directory(options.watch_dir_name, options.socket_name, &options.codegen);
+	}
+	
 	if (options.in_file_name == NULL)
 	{
 		printf("ERROR: No input file supplied.\n");
@@ -71,7 +133,12 @@ int main(int arg_count, const char **args)
 	// Step 1 of compilation: Lexical Analysis
 	//
 	
-	Token_Array tokens = lex_file(options.in_file_name);
+	Token_Array tokens = {0};
+	if (!lex_file(options.in_file_name, &tokens, stdout))
+	{
+		printf("ERROR: Failed to read %s.\n", options.in_file_name);
+		return 1; // Exit with error
+	}
 	
 	bool test_lexer = false;  // Disable lexer output for now
 	if (test_lexer)
@@ -84,7 +151,7 @@ int main(int arg_count, const char **args)
 	// Step 2 of compilation: Parsing tokens into an Abstract Syntax Tree (AST)
 	//
 	
-	Parse_Result parse_result = parse_program(tokens);
+	Parse_Result parse_result = parse_program(tokens, stdout);
 	if (!parse_result.success)
 	{
 		printf("ERROR: Failed to parse.\n");
@@ -98,6 +165,15 @@ int main(int arg_count, const char **args)
 		print_ast(parse_result.ast);
 	}
 	
+	if (options.codegen.profile_file_name != NULL)
+	{
+		if (!load_profile(options.codegen.profile_file_name, &parse_result.fns, stdout))
+		{
+			printf("ERROR: Failed to load profile.\n");
+			return 1; // Exit with error
+		}
+	}
+	
 	//
 	// Step 3 of compilation: Generate asm code by traversing AST
 	//
@@ -109,9 +185,16 @@ int main(int arg_count, const char **args)
 		return 1; // Exit with error
 	}
 	
-	generate_asm(parse_result.ast, out_file);
+	bool success = generate_asm(parse_result.ast, &options.codegen, out_file, stdout);
 	
 	fclose(out_file);
 	
+	if (!success)
+	{
+		remove(options.out_file_name); // Don't leave partial asm behind
+		printf("ERROR: Failed to generate code.\n");
+		return 1; // Exit with error
+	}
+	
 	return 0; // Exit with success
 }
\ No newline at end of file
@@ -0,0 +1,543 @@
+// Loop optimizations, run on each function's AST right before code
+// generation: induction variable strength reduction, then loop-invariant code
+// motion. Loop layout and unrolling happen in codegen (see generate_asm_for_loop)
+
+typedef struct Expr_Ref_Array // Places in the AST that hold an expression
+{
+	AST_Node ***items;
+	long count;
+	long capacity;
+} Expr_Ref_Array;
+
+void expr_ref_array_append(Expr_Ref_Array *array, AST_Node **ref)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(AST_Node **));
+	}
+	array->items[array->count++] = ref;
+}
+
+AST_Node *make_var_node(AST_Var_Data var)
+{
+	AST_Node *node = make_ast_node(AST_VAR);
+	node->var = var;
+	node->value_type = var.type;
+	return node;
+}
+
+AST_Node *make_integer_node(long value, Type type)
+{
+	AST_Node *node = make_ast_node(AST_INTEGER);
+	node->int_value = value;
+	node->value_type = type;
+	return node;
+}
+
+// Arithmetic only; the operands are expected to have the same type
+AST_Node *make_binary_op_node(Token_Kind op, AST_Node *left, AST_Node *right)
+{
+	AST_Node *node = make_ast_node(AST_BINARY_OP);
+	node->value_type = left->value_type;
+	node->binary_op.op = op;
+	node->binary_op.left = left;
+	node->binary_op.right = right;
+	return node;
+}
+
+AST_Node *make_assign_node(AST_Var_Data var, AST_Node *value)
+{
+	AST_Node *node = make_ast_node(AST_ASSIGN);
+	node->assign.var = var;
+	node->assign.value = value;
+	return node;
+}
+
+// A compiler generated variable. Untyped values are stored as i64, the type
+// they are computed in
+AST_Var_Data make_temp_var(AST_Node *fn_node, Type type)
+{
+	if (type == TYPE_NONE) type = TYPE_i64;
+	AST_Var_Data var = {str_lit("$tmp"), fn_node->fn.local_count++, type};
+	return var;
+}
+
+// Block walks use a worklist rather than recursion, since loops and matches
+// can nest arbitrarily deep. An entry stands for a statement and the rest of
+// its block, so a block is pushed as its first statement, and the statement
+// after it is pushed before anything nested in it
+void append_block(AST_Node_Array *pending, AST_List *block)
+{
+	if (block->first != NULL) ast_node_array_append(pending, block->first);
+}
+
+// Counts the assignments to every slot made anywhere in body, nested loops
+// and match arms included
+void count_assignments(AST_List *body, long *counts)
+{
+	AST_Node_Array pending = {0};
+	append_block(&pending, body);
+	while (pending.count > 0)
+	{
+		AST_Node *stmt = pending.items[--pending.count];
+		if (stmt->next != NULL) ast_node_array_append(&pending, stmt->next);
+		
+		if (stmt->kind == AST_LET || stmt->kind == AST_ASSIGN)
+		{
+			counts[stmt->assign.var.slot]++;
+		}
+		else if (stmt->kind == AST_WHILE)
+		{
+			append_block(&pending, &stmt->loop.body);
+		}
+		else if (stmt->kind == AST_MATCH)
+		{
+			for (long arm = 0; arm < stmt->match.arm_count; arm++)
+			{
+				append_block(&pending, &stmt->match.arms[arm]);
+			}
+			append_block(&pending, &stmt->match.else_body);
+		}
+	}
+	free(pending.items);
+}
+
+// Collects the expressions of block in source order, nested blocks included
+void collect_block_exprs(AST_List *block, Expr_Ref_Array *refs)
+{
+	AST_Node_Array pending = {0};
+	append_block(&pending, block);
+	while (pending.count > 0)
+	{
+		AST_Node *stmt = pending.items[--pending.count];
+		if (stmt->next != NULL) ast_node_array_append(&pending, stmt->next);
+		
+		switch (stmt->kind)
+		{
+		case AST_RETURN: if (stmt->ret_expr != NULL) expr_ref_array_append(refs, &stmt->ret_expr); break;
+		case AST_PRINT:  expr_ref_array_append(refs, &stmt->print_expr); break;
+		case AST_LET:
+		case AST_ASSIGN: expr_ref_array_append(refs, &stmt->assign.value); break;
+		case AST_WHILE:
+			expr_ref_array_append(refs, &stmt->loop.cond);
+			append_block(&pending, &stmt->loop.body);
+			break;
+		case AST_MATCH:
+			// Pushed last arm first, so the arms come off the worklist in order
+			expr_ref_array_append(refs, &stmt->match.value);
+			append_block(&pending, &stmt->match.else_body);
+			for (long arm = stmt->match.arm_count - 1; arm >= 0; arm--)
+			{
+				append_block(&pending, &stmt->match.arms[arm]);
+			}
+			break;
+		case AST_CALL:
+			for (long i = 0; i < stmt->call.arg_count; i++)
+			{
+				expr_ref_array_append(refs, &stmt->call.args[i]);
+			}
+			break;
+		default: break;
+		}
+	}
+	free(pending.items);
+}
+
+// Collects every expression evaluated by the loop: its condition and the
+// expressions of all statements in its body, nested loops included
+void collect_loop_exprs(AST_Node *loop, Expr_Ref_Array *refs)
+{
+	expr_ref_array_append(refs, &loop->loop.cond);
+	collect_block_exprs(&loop->loop.body, refs);
+}
+
+typedef struct Induction_Var // i = i + step, once per iteration
+{
+	long slot;
+	long step;
+	AST_Node *update; // The statement stepping it
+} Induction_Var;
+
+typedef struct Reduced_Product // A temp that tracks iv * factor
+{
+	long slot;
+	long factor;
+	AST_Var_Data temp;
+} Reduced_Product;
+
+// Finds a basic induction variable: a top level statement of the body that
+// steps the variable by a constant, where nothing else in the loop assigns it
+bool match_induction_var(AST_Node *stmt, long *assign_counts, Induction_Var *iv)
+{
+	if (stmt->kind != AST_ASSIGN || assign_counts[stmt->assign.var.slot] != 1) return false;
+	
+	AST_Node *value = stmt->assign.value;
+	if (value->kind != AST_BINARY_OP) return false;
+	
+	AST_Node *left = value->binary_op.left;
+	AST_Node *right = value->binary_op.right;
+	long slot = stmt->assign.var.slot;
+	bool left_is_iv = left->kind == AST_VAR && left->var.slot == slot;
+	bool right_is_iv = right->kind == AST_VAR && right->var.slot == slot;
+	
+	if (value->binary_op.op == '+' && left_is_iv && right->kind == AST_INTEGER)
+	{
+		*iv = (Induction_Var){slot, right->int_value, stmt};
+		return true;
+	}
+	if (value->binary_op.op == '+' && right_is_iv && left->kind == AST_INTEGER)
+	{
+		*iv = (Induction_Var){slot, left->int_value, stmt};
+		return true;
+	}
+	if (value->binary_op.op == '-' && left_is_iv && right->kind == AST_INTEGER)
+	{
+		*iv = (Induction_Var){slot, (long)(0UL - (unsigned long)right->int_value), stmt};
+		return true;
+	}
+	return false;
+}
+
+// Replaces iv * constant in the loop with a temp that is set up before the
+// loop and bumped by step * constant right after the induction variable is,
+// turning a multiply per iteration into an add
+void reduce_induction_vars(AST_Node *fn_node, AST_List *parent, AST_Node *loop)
+{
+	long slot_count = fn_node->fn.local_count;
+	long *assign_counts = calloc(slot_count, sizeof(long));
+	count_assignments(&loop->loop.body, assign_counts);
+	
+	Induction_Var *ivs = calloc(slot_count, sizeof(Induction_Var));
+	bool any_ivs = false;
+	for (AST_Node *stmt = loop->loop.body.first; stmt != NULL; stmt = stmt->next)
+	{
+		Induction_Var iv;
+		if (match_induction_var(stmt, assign_counts, &iv))
+		{
+			ivs[iv.slot] = iv;
+			any_ivs = true;
+		}
+	}
+	
+	Expr_Ref_Array refs = {0};
+	if (any_ivs) collect_loop_exprs(loop, &refs);
+	
+	Reduced_Product *products = NULL;
+	long product_count = 0;
+	
+	// Walk every expression, using refs itself as the explicit stack
+	while (refs.count > 0)
+	{
+		AST_Node **ref = refs.items[--refs.count];
+		AST_Node *node = *ref;
+		
+		if (node->kind == AST_NEGATE || node->kind == AST_CAST)
+		{
+			expr_ref_array_append(&refs, &node->operand);
+			continue;
+		}
+		if (node->kind == AST_CALL)
+		{
+			for (long i = 0; i < node->call.arg_count; i++)
+			{
+				expr_ref_array_append(&refs, &node->call.args[i]);
+			}
+			continue;
+		}
+		if (node->kind != AST_BINARY_OP) continue;
+		
+		AST_Node *left = node->binary_op.left;
+		AST_Node *right = node->binary_op.right;
+		AST_Node *var = NULL;
+		AST_Node *factor = NULL;
+		if (node->binary_op.op == '*')
+		{
+			if (left->kind == AST_VAR && right->kind == AST_INTEGER) { var = left; factor = right; }
+			if (right->kind == AST_VAR && left->kind == AST_INTEGER) { var = right; factor = left; }
+		}
+		
+		if (var == NULL || var->var.slot >= slot_count || ivs[var->var.slot].update == NULL)
+		{
+			expr_ref_array_append(&refs, &node->binary_op.left);
+			expr_ref_array_append(&refs, &node->binary_op.right);
+			continue;
+		}
+		
+		Induction_Var *iv = &ivs[var->var.slot];
+		Reduced_Product *product = NULL;
+		for (long i = 0; i < product_count; i++)
+		{
+			if (products[i].slot == iv->slot && products[i].factor == factor->int_value)
+			{
+				product = &products[i];
+			}
+		}
+		
+		if (product == NULL)
+		{
+			products = realloc(products, (product_count + 1) * sizeof(Reduced_Product));
+			product = &products[product_count++];
+			*product = (Reduced_Product){iv->slot, factor->int_value, make_temp_var(fn_node, var->var.type)};
+			
+			// The temp wraps around exactly like i * factor would in the type of i
+			AST_Node *init = make_binary_op_node('*', make_var_node(var->var), make_integer_node(factor->int_value, var->var.type));
+			ast_list_insert_before(parent, loop, make_assign_node(product->temp, init));
+			
+			long step = (long)((unsigned long)iv->step * (unsigned long)factor->int_value);
+			AST_Node *bump = make_binary_op_node('+', make_var_node(product->temp), make_integer_node(step, var->var.type));
+			ast_list_insert_after(&loop->loop.body, iv->update, make_assign_node(product->temp, bump));
+		}
+		
+		*ref = make_var_node(product->temp);
+		free_ast(node);
+	}
+	
+	free(products);
+	free(refs.items);
+	free(ivs);
+	free(assign_counts);
+}
+
+typedef struct Invariance_Frame
+{
+	AST_Node **ref;
+	int stage;                 // How many operands have been visited so far
+	bool operand_invariant[2]; // Filled in by the operands as they finish
+} Invariance_Frame;
+
+typedef struct Invariance_Frame_Array
+{
+	Invariance_Frame *items;
+	long count;
+	long capacity;
+} Invariance_Frame_Array;
+
+void invariance_frame_array_append(Invariance_Frame_Array *array, AST_Node **ref)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Invariance_Frame));
+	}
+	array->items[array->count++] = (Invariance_Frame){ref, 0, {false, false}};
+}
+
+// Moves the expression at ref into a temp computed once before the loop
+void hoist_expr(AST_Node *fn_node, AST_List *parent, AST_Node *loop, AST_Node **ref)
+{
+	Type type = (*ref)->value_type;
+	AST_Var_Data temp = make_temp_var(fn_node, type);
+	ast_list_insert_before(parent, loop, make_assign_node(temp, *ref));
+	*ref = make_var_node(temp);
+	(*ref)->value_type = type; // Still untyped if the expression was
+}
+
+bool is_leaf_expr(AST_Node *node)
+{
+	return node->kind == AST_INTEGER || node->kind == AST_VAR;
+}
+
+// Loop-invariant code motion: every largest subexpression whose variables are
+// not assigned anywhere in the loop is computed once before it instead. Only
+// expressions that can't trap are moved, so division and remainder stay
+// put; the loop may run zero times, or exit before reaching them
+void hoist_loop_invariants(AST_Node *fn_node, AST_List *parent, AST_Node *loop)
+{
+	long slot_count = fn_node->fn.local_count;
+	long *assign_counts = calloc(slot_count, sizeof(long));
+	count_assignments(&loop->loop.body, assign_counts);
+	
+	Expr_Ref_Array roots = {0};
+	collect_loop_exprs(loop, &roots);
+	
+	// Visits each expression bottom up with an explicit stack. A finished node
+	// reports whether it is invariant to its parent's frame
+	Invariance_Frame_Array frames = {0};
+	for (long root = 0; root < roots.count; root++)
+	{
+		bool root_invariant = false;
+		invariance_frame_array_append(&frames, roots.items[root]);
+		
+		while (frames.count > 0)
+		{
+			Invariance_Frame *frame = &frames.items[frames.count - 1];
+			AST_Node *node = *frame->ref;
+			
+			bool finished = true;
+			bool invariant = false;
+			switch (node->kind)
+			{
+			case AST_INTEGER:
+				invariant = true;
+				break;
+			
+			case AST_CALL: // Could have side effects, and its arguments are left alone
+				break;
+			
+			case AST_VAR:
+				// Temps from earlier hoists are past slot_count, and only set outside the loop
+				invariant = node->var.slot >= slot_count || assign_counts[node->var.slot] == 0;
+				break;
+			
+			case AST_NEGATE:
+			case AST_CAST:
+				if (frame->stage++ == 0)
+				{
+					invariance_frame_array_append(&frames, &node->operand);
+					finished = false;
+				}
+				else
+				{
+					invariant = frame->operand_invariant[0];
+				}
+				break;
+			
+			case AST_BINARY_OP:
+				if (frame->stage < 2)
+				{
+					AST_Node **operand = frame->stage == 0 ? &node->binary_op.left : &node->binary_op.right;
+					frame->stage++;
+					invariance_frame_array_append(&frames, operand);
+					finished = false;
+				}
+				else
+				{
+					bool can_trap = node->binary_op.op == '/' || node->binary_op.op == '%';
+					invariant = frame->operand_invariant[0] && frame->operand_invariant[1] && !can_trap;
+					if (!invariant)
+					{
+						// This node stays in the loop, but its invariant operands can still move
+						if (frame->operand_invariant[0] && !is_leaf_expr(node->binary_op.left))
+						{
+							hoist_expr(fn_node, parent, loop, &node->binary_op.left);
+						}
+						if (frame->operand_invariant[1] && !is_leaf_expr(node->binary_op.right))
+						{
+							hoist_expr(fn_node, parent, loop, &node->binary_op.right);
+						}
+					}
+				}
+				break;
+			
+			default:
+				break;
+			}
+			
+			if (!finished) continue;
+			
+			frames.count--;
+			if (frames.count > 0)
+			{
+				Invariance_Frame *parent_frame = &frames.items[frames.count - 1];
+				parent_frame->operand_invariant[parent_frame->stage - 1] = invariant;
+			}
+			else
+			{
+				root_invariant = invariant;
+			}
+		}
+		
+		if (root_invariant && !is_leaf_expr(*roots.items[root]))
+		{
+			hoist_expr(fn_node, parent, loop, roots.items[root]);
+		}
+	}
+	
+	free(frames.items);
+	free(roots.items);
+	free(assign_counts);
+}
+
+// Every optimized loop walks its whole body, so loops with more levels of
+// loops than this inside them are left as they are. That keeps the work
+// linear in the size of the function however deep the nesting goes
+#define MAX_OPTIMIZED_LOOP_NEST 8
+
+typedef struct Loop_Frame // Progress through one block whose loops are being optimized
+{
+	AST_List *list;
+	AST_Node *next;   // The next statement to look at
+	AST_Node *loop;   // The loop this block is the body of, NULL for other blocks
+	AST_List *parent; // The block holding loop
+	long nest;        // Levels of loops found in this block so far
+} Loop_Frame;
+
+typedef struct Loop_Frame_Array
+{
+	Loop_Frame *items;
+	long count;
+	long capacity;
+} Loop_Frame_Array;
+
+void loop_frame_array_append(Loop_Frame_Array *array, Loop_Frame frame)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Loop_Frame));
+	}
+	array->items[array->count++] = frame;
+}
+
+// Optimizes the loops in list, innermost first, so code hoisted out of an
+// inner loop can then be considered for hoisting out of the outer one.
+// Nested blocks are kept on an explicit stack rather than recursed into
+void optimize_loops_in_list(AST_Node *fn_node, AST_List *list)
+{
+	Loop_Frame_Array frames = {0};
+	loop_frame_array_append(&frames, (Loop_Frame){list, list->first, NULL, NULL, 0});
+	while (frames.count > 0)
+	{
+		Loop_Frame *frame = &frames.items[frames.count - 1];
+		AST_Node *stmt = frame->next;
+		if (stmt != NULL)
+		{
+			frame->next = stmt->next;
+			AST_List *stmt_list = frame->list;
+			if (stmt->kind == AST_WHILE)
+			{
+				loop_frame_array_append(&frames, (Loop_Frame){&stmt->loop.body, stmt->loop.body.first, stmt, stmt_list, 0});
+			}
+			else if (stmt->kind == AST_MATCH)
+			{
+				// Pushed last arm first, so the arms are optimized in order
+				AST_List *else_body = &stmt->match.else_body;
+				loop_frame_array_append(&frames, (Loop_Frame){else_body, else_body->first, NULL, NULL, 0});
+				for (long arm = stmt->match.arm_count - 1; arm >= 0; arm--)
+				{
+					AST_List *arm_body = &stmt->match.arms[arm];
+					loop_frame_array_append(&frames, (Loop_Frame){arm_body, arm_body->first, NULL, NULL, 0});
+				}
+			}
+			continue;
+		}
+		
+		// Everything inside the block is done, so its loop can go
+		Loop_Frame done = frames.items[--frames.count];
+		long nest = done.nest;
+		if (done.loop != NULL)
+		{
+			nest++;
+			if (nest <= MAX_OPTIMIZED_LOOP_NEST)
+			{
+				reduce_induction_vars(fn_node, done.parent, done.loop);
+				hoist_loop_invariants(fn_node, done.parent, done.loop);
+			}
+		}
+		// Match arms pass it on to the next arm, and the last to the enclosing block
+		if (frames.count > 0 && frames.items[frames.count - 1].nest < nest)
+		{
+			frames.items[frames.count - 1].nest = nest;
+		}
+	}
+	free(frames.items);
+}
+
+void optimize_loops(AST_Node *ast)
+{
+	for (AST_Node *fn_node = ast->program.first; fn_node != NULL; fn_node = fn_node->next)
+	{
+		optimize_loops_in_list(fn_node, &fn_node->fn.body);
+	}
+}
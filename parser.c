@@ -6,7 +6,18 @@ typedef enum AST_Kind
 	AST_FN,
 	AST_TYPE,
 	AST_RETURN,
+	AST_PRINT,
 	AST_INTEGER,
+	AST_NEGATE,
+	AST_CAST,
+	AST_BINARY_OP,
+	AST_VAR,
+	AST_CALL,
+	AST_PARAM,
+	AST_LET,
+	AST_ASSIGN,
+	AST_WHILE,
+	AST_MATCH,
 	// TODO: Add more as needed
 } AST_Kind;
 
@@ -19,7 +30,18 @@ const char *ast_kind_as_cstr(AST_Kind kind)
 	case AST_FN:      return "FN";
 	case AST_TYPE:    return "TYPE";
 	case AST_RETURN:  return "RETURN";
+	case AST_PRINT:   return "PRINT";
 	case AST_INTEGER: return "INTEGER";
+	case AST_NEGATE:  return "NEGATE";
+	case AST_CAST:    return "CAST";
+	case AST_BINARY_OP: return "BINARY_OP";
+	case AST_VAR:     return "VAR";
+	case AST_CALL:    return "CALL";
+	case AST_PARAM:   return "PARAM";
+	case AST_LET:     return "LET";
+	case AST_ASSIGN:  return "ASSIGN";
+	case AST_WHILE:   return "WHILE";
+	case AST_MATCH:   return "MATCH";
 		// TODO: Handle additional cases as you add kinds
 	default:          return "UNKNOWN (ERROR!)";
 	}
@@ -37,16 +59,87 @@ typedef struct AST_List // Doubly linked list of AST_Nodes
 typedef struct AST_Fn_Data
 {
 	String name;
-	AST_List parameters;
+	long index; // Position in source order
+	unsigned long profile_count; // Calls recorded by an instrumented run
+	AST_Node *folded_into; // Set by identical code folding to the function sharing our code
+	AST_Node *next_alias;  // Chain of functions folded into this one
+	AST_List parameters; // AST_PARAM nodes, which are also its first locals
 	Type return_type;
 	AST_List body;
+	long local_count; // Number of local variables, parameters included
+	
+	// Stack layout, chosen by codegen
+	bool is_leaf;          // Calls nothing, so it needs no aligned stack
+	unsigned saved_regs;   // Callee-saved registers it uses, one bit per Reg
+	bool has_frame;        // Some locals live on the stack, addressed from rbp
+	long frame_size;       // Bytes of stack those locals take up
+	long stack_reserve;    // Subtracted from rsp after the pushes
 } AST_Fn_Data;
 
+typedef struct AST_Binary_Op_Data
+{
+	Token_Kind op; // '+', '-', '*', '/', '%' or a comparison
+	AST_Node *left;
+	AST_Node *right;
+} AST_Binary_Op_Data;
+
+typedef struct AST_Var_Data
+{
+	String name;
+	long slot;   // Numbers the variables of a function
+	Type type;
+	
+	// Where codegen keeps it: a register, or a stack slot if home_reg is 0
+	int home_reg;
+	long offset; // Below the frame pointer
+} AST_Var_Data;
+
+typedef struct AST_Call_Data
+{
+	String name;
+	AST_Node *fn;
+	AST_Node **args; // An array rather than a list, so passes can replace args in place
+	long arg_count;
+} AST_Call_Data;
+
+typedef struct AST_Assign_Data
+{
+	AST_Var_Data var;
+	AST_Node *value;
+	Loc loc; // Of the name, for AST_PARAM
+} AST_Assign_Data;
+
+typedef struct AST_While_Data
+{
+	AST_Node *cond;
+	AST_List body;
+	long index; // Numbers the loop's labels, unique within its function
+} AST_While_Data;
+
+typedef struct AST_Match_Case // One value of a match arm
+{
+	long value;
+	long arm; // Index into AST_Match_Data.arms
+	Loc loc;
+} AST_Match_Case;
+
+typedef struct AST_Match_Data
+{
+	AST_Node *value;
+	AST_Match_Case *cases; // Sorted by value, in the order of the value's type
+	long case_count;
+	AST_List *arms;        // The body of each arm
+	long arm_count;
+	AST_List else_body;    // Runs when no case matches
+	long index; // Numbers the match's labels, unique within its function
+} AST_Match_Data;
+
 struct AST_Node
 {
 	AST_Kind kind;
 	AST_Node *prev;
 	AST_Node *next; // Used to make nodes into a doubly-linked list
+	Type value_type; // For expressions, TYPE_NONE while untyped
 	
 	union // This stores the extra data for the particular kind of node
 	{
@@ -54,17 +147,115 @@ struct AST_Node
 		AST_Fn_Data fn;        // Data for AST_FN
 		Type        type;      // Data for AST_TYPE
 		AST_Node   *ret_expr;  // Data for AST_RETURN
+		AST_Node   *print_expr; // Data for AST_PRINT
 		long        int_value; // Data for AST_INTEGER
+		AST_Node   *operand;   // Data for AST_NEGATE and AST_CAST, whose type is value_type
+		AST_Binary_Op_Data binary_op; // Data for AST_BINARY_OP
+		AST_Var_Data    var;    // Data for AST_VAR
+		AST_Call_Data   call;   // Data for AST_CALL
+		AST_Assign_Data assign; // Data for AST_LET, AST_ASSIGN and AST_PARAM (with no value)
+		AST_While_Data  loop;   // Data for AST_WHILE
+		AST_Match_Data  match;  // Data for AST_MATCH
 	};
 };
 
+typedef struct Symbol
+{
+	String name; // name.data == NULL marks an empty slot
+	Loc loc;     // Where the symbol was defined, for duplicate errors
+	AST_Node *node;
+} Symbol;
+
+typedef struct Symbol_Table // Open-addressing hash map keyed by name
+{
+	Symbol *items;
+	long count;
+	long capacity; // Always a power of two
+} Symbol_Table;
+
+// Returns the slot holding name, or the empty slot where it would go
+Symbol *symbol_table_slot(Symbol_Table *table, String name)
+{
+	unsigned long mask = table->capacity - 1;
+	unsigned long index = str_hash(name) & mask;
+	while (true)
+	{
+		Symbol *slot = &table->items[index];
+		if (slot->name.data == NULL || str_equal(slot->name, name))
+		{
+			return slot;
+		}
+		index = (index + 1) & mask; // Linear probing
+	}
+}
+
+void symbol_table_reserve(Symbol_Table *table, long count)
+{
+	// Keep the load factor at or below 1/2 so probe sequences stay short
+	long capacity = table->capacity == 0 ? 16 : table->capacity;
+	while (capacity < count * 2)
+	{
+		capacity *= 2;
+	}
+	if (capacity == table->capacity) return;
+	
+	Symbol_Table grown = {
+		.items = calloc(capacity, sizeof(Symbol)),
+		.count = table->count,
+		.capacity = capacity,
+	};
+	for (long i = 0; i < table->capacity; i++)
+	{
+		if (table->items[i].name.data != NULL)
+		{
+			*symbol_table_slot(&grown, table->items[i].name) = table->items[i];
+		}
+	}
+	free(table->items);
+	*table = grown;
+}
+
+Symbol *symbol_table_find(Symbol_Table *table, String name)
+{
+	if (table->count == 0) return NULL;
+	Symbol *slot = symbol_table_slot(table, name);
+	return slot->name.data != NULL ? slot : NULL;
+}
+
+// Returns the existing symbol if name is already defined, NULL on success
+Symbol *symbol_table_insert(Symbol_Table *table, String name, Loc loc, AST_Node *node)
+{
+	symbol_table_reserve(table, table->count + 1);
+	Symbol *slot = symbol_table_slot(table, name);
+	if (slot->name.data != NULL)
+	{
+		return slot;
+	}
+	*slot = (Symbol){name, loc, node};
+	table->count++;
+	return NULL;
+}
+
 typedef struct Parser
 {
 	Token_Array tokens;
 	long tok_index;
 	bool has_error; // Keep track of if we've encountered an error
+	Symbol_Table fns; // Every function defined so far, keyed by name
+	FILE *err_file;   // Where diagnostics go
+	Token missing_eof; // Stands in for the EOF token when there are no tokens at all
+	
+	// State for the function being parsed
+	Symbol_Table locals; // Its variables, keyed by name
+	long local_count;
+	long loop_count;
+	long match_count;
+	Type return_type;
 } Parser;
 
+// Arguments are only passed in registers, rdi, rsi, rdx, rcx, r8 and r9
+#define MAX_PARAMS 6
+
 AST_Node *make_ast_node(AST_Kind kind)
 {
 	AST_Node *result = calloc(1, sizeof(AST_Node));
@@ -74,14 +265,18 @@ AST_Node *make_ast_node(AST_Kind kind)
 
 void report_error(Parser *parser, Token *tok, const char *message)
 {
-	print_loc(tok->loc);
-	printf(": %s", message);
+	print_loc(parser->err_file, tok->loc);
+	fprintf(parser->err_file, ": %s", message);
 	parser->has_error = true;
 }
 
 Token *peek_token(Parser *parser, int offset)
 {
 	long index = parser->tok_index + offset;
+	if (parser->tokens.count == 0)
+	{
+		return &parser->missing_eof;
+	}
 	if (index >= parser->tokens.count)
 	{
 		Token *EOF_Token = &parser->tokens.items[parser->tokens.count - 1];
@@ -96,11 +291,11 @@ Token *expect_token(Parser *parser, Token_Kind expected_kind)
 	
 	if (actual->kind != expected_kind) {
 		report_error(parser, actual, "ERROR: Unexpected token\n");
-		printf("ERROR: Expected ");
-		print_token_kind(expected_kind);
-		printf(", got ");
-		print_token_kind(actual->kind);
-		printf("\n");
+		fprintf(parser->err_file, "ERROR: Expected ");
+		print_token_kind(parser->err_file, expected_kind);
+		fprintf(parser->err_file, ", got ");
+		print_token_kind(parser->err_file, actual->kind);
+		fprintf(parser->err_file, "\n");
 		return actual;
 	}
 	
@@ -117,14 +312,89 @@ Token *expect_keyword(Parser *parser, Keyword expected_keyword)
 	if (actual->keyword != expected_keyword)
 	{
 		report_error(parser, actual, "ERROR: Unexpected keyword\n");
-		printf("Expected keyword %.*s, got ", PRINT_STRING(keyword_names[expected_keyword]));
-		print_token(actual);
-		printf("\n");
+		fprintf(parser->err_file, "Expected keyword %.*s, got ", PRINT_STRING(keyword_names[expected_keyword]));
+		print_token(parser->err_file, actual);
+		fprintf(parser->err_file, "\n");
 	}
 	
 	return actual;
 }
 
+Token *expect_local(Parser *parser, Symbol **local)
+{
+	Token *name = expect_token(parser, TOKEN_IDENT);
+	if (parser->has_error) return name;
+	
+	*local = symbol_table_find(&parser->locals, name->text);
+	if (*local == NULL)
+	{
+		report_error(parser, name, "ERROR: Undeclared variable ");
+		fprintf(parser->err_file, "%.*s\n", PRINT_STRING(name->text));
+	}
+	
+	return name;
+}
+
+// int is another name for i64
+Token *expect_type(Parser *parser, Type *type)
+{
+	Token *tok = expect_token(parser, TOKEN_TYPE);
+	if (parser->has_error) return tok;
+	
+	*type = tok->type == TYPE_int ? TYPE_i64 : tok->type;
+	return tok;
+}
+
+// Calls to functions without a return type can only be statements
+void check_has_value(Parser *parser, AST_Node *expr, Token *tok)
+{
+	if (expr->kind == AST_CALL && expr->call.fn->fn.return_type == TYPE_NONE)
+	{
+		report_error(parser, tok, "ERROR: Function ");
+		fprintf(parser->err_file, "%.*s returns no value\n", PRINT_STRING(expr->call.name));
+	}
+}
+
+// Gives an untyped expression the type its context expects, checking that a
+// literal fits, or reports a mismatch between two typed ones. Constant
+// expressions are folded into literals by then. Other untyped expressions
+// (built on comparisons) are computed as i64 and cast, wrapping around
+void coerce_expr(Parser *parser, AST_Node *expr, Type type, Token *tok)
+{
+	check_has_value(parser, expr, tok);
+	if (parser->has_error || type == TYPE_NONE || expr->value_type == type) return;
+	
+	if (expr->value_type == TYPE_NONE)
+	{
+		if (expr->kind != AST_INTEGER)
+		{
+			// Turned into the cast in place, since the caller holds expr
+			AST_Node *operand = make_ast_node(expr->kind);
+			*operand = *expr;
+			*expr = (AST_Node){.kind = AST_CAST, .prev = operand->prev, .next = operand->next, .value_type = type};
+			operand->prev = NULL;
+			operand->next = NULL;
+			expr->operand = operand;
+			return;
+		}
+		
+		bool fits = expr->int_value >= 0 ?
+			(unsigned long)expr->int_value <= type_max(type) :
+			type_is_signed[type] && expr->int_value >= -(long)type_max(type) - 1;
+		if (!fits)
+		{
+			report_error(parser, tok, "ERROR: Integer literal ");
+			fprintf(parser->err_file, "%ld is out of range for %.*s\n", expr->int_value, PRINT_STRING(type_names[type]));
+			return;
+		}
+		expr->value_type = type;
+		return;
+	}
+	
+	report_error(parser, tok, "ERROR: Mismatched types, expected ");
+	fprintf(parser->err_file, "%.*s but got %.*s\n", PRINT_STRING(type_names[type]), PRINT_STRING(type_names[expr->value_type]));
+}
+
 void ast_list_append(AST_List *list, AST_Node *node)
 {
 	// TODO: Implement appending to a doubly-linked list
@@ -148,9 +418,72 @@ void ast_list_append(AST_List *list, AST_Node *node)
 	list->count++;
 }
 
+void ast_list_insert_before(AST_List *list, AST_Node *before, AST_Node *node)
+{
+	node->prev = before->prev;
+	node->next = before;
+	if (before->prev != NULL)
+	{
+		before->prev->next = node;
+	}
+	else
+	{
+		list->first = node;
+	}
+	before->prev = node;
+	list->count++;
+}
+
+void ast_list_insert_after(AST_List *list, AST_Node *after, AST_Node *node)
+{
+	node->prev = after;
+	node->next = after->next;
+	if (after->next != NULL)
+	{
+		after->next->prev = node;
+	}
+	else
+	{
+		list->last = node;
+	}
+	after->next = node;
+	list->count++;
+}
+
 AST_Node *parse_statement(Parser *parser);
 AST_Node *parse_expression(Parser *parser);
+void free_ast(AST_Node *node);
+AST_List *parse_match_arm(Parser *parser, AST_Node *match, Type type, bool *has_else);
+void sort_match_cases(Parser *parser, AST_Node *match, Type type);
+
+typedef struct Block_Frame // A block, or the arms of a match, still being parsed
+{
+	AST_List *list;   // Where the block's statements go, NULL for match arms
+	AST_Node *match;  // The match whose arms are being parsed
+	Type match_type;
+	bool has_else;
+} Block_Frame;
+
+typedef struct Block_Frame_Array
+{
+	Block_Frame *items;
+	long count;
+	long capacity;
+} Block_Frame_Array;
 
+void block_frame_array_append(Block_Frame_Array *array, Block_Frame frame)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Block_Frame));
+	}
+	array->items[array->count++] = frame;
+}
+
+// Parses { statements }, along with the blocks nested in them. Loop bodies
+// and match arms are kept on a stack of open blocks rather than parsed by
+// recursion, so deeply nested input can't overflow the compiler's stack
 AST_List parse_block(Parser *parser)
 {
 	AST_List result = {0};
@@ -158,48 +491,506 @@ AST_List parse_block(Parser *parser)
 	expect_token(parser, '{');
 	if (parser->has_error) return result;
 	
-	Token *tok = peek_token(parser, 0);
-	while (tok->kind != '}' && tok->kind != TOKEN_EOF)
+	Block_Frame_Array blocks = {0};
+	block_frame_array_append(&blocks, (Block_Frame){.list = &result});
+	while (blocks.count > 0 && !parser->has_error)
 	{
-		// TODO: Parse the statements of the block
-		// TODO: Add them to the result
-		// NOTE: At this point in the code, we should expect tok to be the first
-		//       token of a statement, and we have not advanced the parser past
-		//       this token
+		Block_Frame *block = &blocks.items[blocks.count - 1];
+		Token *tok = peek_token(parser, 0);
+		if (tok->kind == '}' || tok->kind == TOKEN_EOF)
+		{
+			expect_token(parser, '}');
+			if (parser->has_error) break;
+			if (block->list == NULL) sort_match_cases(parser, block->match, block->match_type);
+			blocks.count--;
+			continue;
+		}
+		
+		if (block->list == NULL)
+		{
+			AST_List *arm_body = parse_match_arm(parser, block->match, block->match_type, &block->has_else);
+			if (parser->has_error) break;
+			expect_token(parser, '{');
+			if (parser->has_error) break;
+			block_frame_array_append(&blocks, (Block_Frame){.list = arm_body});
+			continue;
+		}
 		
-		// Parse the statements of the block
 		AST_Node *stmt = parse_statement(parser);
 		if (stmt != NULL)
 		{
-			ast_list_append(&result, stmt);
+			ast_list_append(block->list, stmt);
 		}
+		if (parser->has_error) break;
 		
-		// Update tok for the next iteration
-		tok = peek_token(parser, 0);
-		
-		if (parser->has_error) return result;
+		// parse_statement stops at the '{' of a loop body or of match arms,
+		// which are parsed next
+		if (stmt->kind == AST_WHILE)
+		{
+			expect_token(parser, '{');
+			if (parser->has_error) break;
+			block_frame_array_append(&blocks, (Block_Frame){.list = &stmt->loop.body});
+		}
+		else if (stmt->kind == AST_MATCH)
+		{
+			expect_token(parser, '{');
+			if (parser->has_error) break;
+			Type type = stmt->match.value->value_type != TYPE_NONE ? stmt->match.value->value_type : TYPE_i64;
+			block_frame_array_append(&blocks, (Block_Frame){.match = stmt, .match_type = type});
+		}
 	}
-	expect_token(parser, '}');
 	
+	free(blocks.items);
 	return result;
 }
 
+// Binding power of each binary operator, 0 for tokens that aren't one.
+// All binary operators are left associative
+const int binary_op_precedence[128] = {
+	['<']      = 1,
+	['>']      = 1,
+	[TOKEN_LE] = 1,
+	[TOKEN_GE] = 1,
+	[TOKEN_EQ] = 1,
+	[TOKEN_NE] = 1,
+	['+'] = 2,
+	['-'] = 2,
+	['*'] = 3,
+	['/'] = 3,
+	['%'] = 3,
+};
+
+#define UNARY_OP_PRECEDENCE 4
+
+typedef struct Pending_Op // An operator waiting on the parser's operator stack
+{
+	Token_Kind op;  // '(' marks an open parenthesis
+	int precedence;
+	bool is_unary;
+	Token *tok;     // For error messages
+	AST_Node *call; // For the '(' of a call, the call collecting its arguments
+} Pending_Op;
+
+typedef struct Pending_Op_Array
+{
+	Pending_Op *items;
+	long count;
+	long capacity;
+} Pending_Op_Array;
+
+typedef struct AST_Node_Array
+{
+	AST_Node **items;
+	long count;
+	long capacity;
+} AST_Node_Array;
+
+void pending_op_array_append(Pending_Op_Array *array, Pending_Op op)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(Pending_Op));
+	}
+	array->items[array->count++] = op;
+}
+
+void ast_node_array_append(AST_Node_Array *array, AST_Node *node)
+{
+	if (array->count >= array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 16 : array->capacity * 2;
+		array->items = realloc(array->items, array->capacity * sizeof(AST_Node *));
+	}
+	array->items[array->count++] = node;
+}
+
+// Computes left op right for two untyped literals, as the i64 code for the
+// expression would. Returns false where that would trap, leaving it to run
+bool fold_untyped_op(Token_Kind op, long left, long right, long *result)
+{
+	unsigned long a = left;
+	unsigned long b = right;
+	switch ((int)op)
+	{
+	case '+': *result = (long)(a + b); return true;
+	case '-': *result = (long)(a - b); return true;
+	case '*': *result = (long)(a * b); return true;
+	case '/':
+	case '%':
+		if (right == 0 || (right == -1 && left == LONG_MIN)) return false;
+		*result = op == '/' ? left / right : left % right;
+		return true;
+	case '<':      *result = left < right;  return true;
+	case '>':      *result = left > right;  return true;
+	case TOKEN_LE: *result = left <= right; return true;
+	case TOKEN_GE: *result = left >= right; return true;
+	case TOKEN_EQ: *result = left == right; return true;
+	case TOKEN_NE: *result = left != right; return true;
+	default: return false;
+	}
+}
+
+// Pops the top operator and the operands it needs, and pushes the combined
+// node. Both operands of a binary operator must have the same type, and an
+// untyped literal takes the type of the other side. Operators on two untyped
+// literals are folded, so the result is range checked like a single literal
+void reduce_pending_op(Parser *parser, Pending_Op_Array *ops, AST_Node_Array *operands)
+{
+	Pending_Op op = ops->items[--ops->count];
+	if (op.is_unary)
+	{
+		AST_Node *operand = operands->items[operands->count - 1];
+		check_has_value(parser, operand, op.tok);
+		if (operand->kind == AST_INTEGER && operand->value_type == TYPE_NONE)
+		{
+			// Fold, so -128 can be checked against i8 as a whole
+			operand->int_value = -operand->int_value;
+			return;
+		}
+		AST_Node *node = make_ast_node(AST_NEGATE);
+		node->operand = operand;
+		node->value_type = operand->value_type;
+		operands->items[operands->count - 1] = node;
+	}
+	else
+	{
+		AST_Node *left = operands->items[operands->count - 2];
+		AST_Node *right = operands->items[operands->count - 1];
+		if (left->kind == AST_INTEGER && left->value_type == TYPE_NONE &&
+			right->kind == AST_INTEGER && right->value_type == TYPE_NONE &&
+			fold_untyped_op(op.op, left->int_value, right->int_value, &left->int_value))
+		{
+			free_ast(right);
+			operands->count--;
+			return;
+		}
+		
+		coerce_expr(parser, left, right->value_type, op.tok);
+		if (!parser->has_error) coerce_expr(parser, right, left->value_type, op.tok);
+		Type type = left->value_type != TYPE_NONE ? left->value_type : right->value_type;
+		
+		AST_Node *node = make_ast_node(AST_BINARY_OP);
+		node->binary_op.op = op.op;
+		node->binary_op.left = left;
+		node->binary_op.right = right;
+		// Comparisons give 0 or 1, which fits any type
+		node->value_type = binary_op_precedence[op.op] > 1 ? type : TYPE_NONE;
+		operands->items[operands->count - 2] = node;
+		operands->count--;
+	}
+}
+
+// Appends an argument to a call node, growing its argument list by one
+void call_append_arg(AST_Node *call, AST_Node *arg)
+{
+	call->call.args = realloc(call->call.args, (call->call.arg_count + 1) * sizeof(AST_Node *));
+	call->call.args[call->call.arg_count++] = arg;
+}
+
+// Checks a call's arguments against the parameters of the function it calls
+void check_call_args(Parser *parser, AST_Node *call, Token *tok)
+{
+	AST_Node *fn_node = call->call.fn;
+	if (call->call.arg_count != fn_node->fn.parameters.count)
+	{
+		report_error(parser, tok, "ERROR: Function ");
+		fprintf(parser->err_file, "%.*s takes %ld arguments, got %ld\n", PRINT_STRING(call->call.name),
+		        fn_node->fn.parameters.count, call->call.arg_count);
+		return;
+	}
+	
+	long i = 0;
+	for (AST_Node *param = fn_node->fn.parameters.first; param != NULL && !parser->has_error; param = param->next)
+	{
+		coerce_expr(parser, call->call.args[i++], param->assign.var.type, tok);
+	}
+}
+
+// Operator precedence parser driven by explicit heap stacks instead of C
+// recursion, so nesting depth is only limited by memory and parsing stays
+// linear however deep the input goes
 AST_Node *parse_expression(Parser *parser)
 {
+	Pending_Op_Array ops = {0};
+	AST_Node_Array operands = {0};
+	long open_parens = 0;
+	bool expect_operand = true;
+	
+	while (!parser->has_error)
+	{
+		Token *tok = peek_token(parser, 0);
+		
+		if (expect_operand)
+		{
+			if (tok->kind == TOKEN_INTEGER)
+			{
+				AST_Node *node = make_ast_node(AST_INTEGER);
+				node->int_value = tok->int_value;
+				node->value_type = tok->int_type;
+				ast_node_array_append(&operands, node);
+				expect_operand = false;
+			}
+			else if (tok->kind == TOKEN_IDENT && peek_token(parser, 1)->kind == '(')
+			{
+				Symbol *fn = symbol_table_find(&parser->fns, tok->text);
+				if (fn == NULL)
+				{
+					report_error(parser, tok, "ERROR: Call to undefined function ");
+					fprintf(parser->err_file, "%.*s\n", PRINT_STRING(tok->text));
+					break;
+				}
+				
+				AST_Node *node = make_ast_node(AST_CALL);
+				node->call.name = tok->text;
+				node->call.fn = fn->node;
+				node->value_type = fn->node->fn.return_type;
+				parser->tok_index += 2; // Advance past the name and '('
+				
+				if (peek_token(parser, 0)->kind != ')')
+				{
+					// The arguments are parsed like a parenthesized expression, with
+					// each ',' and the closing ')' handing one to the call
+					pending_op_array_append(&ops, (Pending_Op){'(', 0, false, tok, node});
+					open_parens++;
+					continue;
+				}
+				check_call_args(parser, node, tok);
+				ast_node_array_append(&operands, node);
+				expect_operand = false;
+			}
+			else if (tok->kind == TOKEN_IDENT)
+			{
+				Symbol *local = NULL;
+				expect_local(parser, &local);
+				if (parser->has_error) break;
+				
+				AST_Node *node = make_ast_node(AST_VAR);
+				node->var = local->node->assign.var;
+				node->value_type = node->var.type;
+				ast_node_array_append(&operands, node);
+				expect_operand = false;
+				continue; // expect_local already advanced
+			}
+			else if (tok->kind == '(')
+			{
+				pending_op_array_append(&ops, (Pending_Op){'(', 0, false, tok, NULL});
+				open_parens++;
+			}
+			else if (tok->kind == '-')
+			{
+				pending_op_array_append(&ops, (Pending_Op){'-', UNARY_OP_PRECEDENCE, true, tok, NULL});
+			}
+			else if (tok->kind == TOKEN_NONE) // Bad literal, already reported by the lexer
+			{
+				parser->has_error = true;
+				break;
+			}
+			else
+			{
+				report_error(parser, tok, "ERROR: Expected expression\n");
+				break;
+			}
+			++parser->tok_index;
+		}
+		else if (tok->kind < 128 && binary_op_precedence[tok->kind] > 0)
+		{
+			int precedence = binary_op_precedence[tok->kind];
+			while (ops.count > 0 && ops.items[ops.count - 1].precedence >= precedence)
+			{
+				reduce_pending_op(parser, &ops, &operands);
+			}
+			pending_op_array_append(&ops, (Pending_Op){tok->kind, precedence, false, tok, NULL});
+			expect_operand = true;
+			++parser->tok_index;
+		}
+		else if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_as)
+		{
+			// Postfix, binding looser than unary minus like in Rust: -x as u8 is (-x) as u8
+			while (ops.count > 0 && ops.items[ops.count - 1].precedence >= UNARY_OP_PRECEDENCE)
+			{
+				reduce_pending_op(parser, &ops, &operands);
+			}
+			++parser->tok_index; // Advance past 'as'
+			
+			AST_Node *node = make_ast_node(AST_CAST);
+			expect_type(parser, &node->value_type);
+			node->operand = operands.items[operands.count - 1];
+			operands.items[operands.count - 1] = node;
+			check_has_value(parser, node->operand, tok);
+		}
+		else if ((tok->kind == ')' || tok->kind == ',') && open_parens > 0)
+		{
+			while (ops.items[ops.count - 1].op != '(')
+			{
+				reduce_pending_op(parser, &ops, &operands);
+			}
+			
+			Pending_Op *paren = &ops.items[ops.count - 1];
+			AST_Node *call = paren->call;
+			if (call == NULL && tok->kind == ',')
+			{
+				report_error(parser, tok, "ERROR: Expected ')'\n");
+				break;
+			}
+			if (call != NULL)
+			{
+				call_append_arg(call, operands.items[--operands.count]);
+			}
+			
+			if (tok->kind == ',')
+			{
+				expect_operand = true;
+			}
+			else
+			{
+				if (call != NULL)
+				{
+					check_call_args(parser, call, paren->tok);
+					ast_node_array_append(&operands, call);
+				}
+				ops.count--; // Pop the '('
+				open_parens--;
+			}
+			++parser->tok_index;
+		}
+		else // Anything else ends the expression
+		{
+			break;
+		}
+	}
+	
+	if (!parser->has_error && open_parens > 0)
+	{
+		report_error(parser, peek_token(parser, 0), "ERROR: Expected ')'\n");
+	}
+	
+	AST_Node *result = NULL;
+	if (!parser->has_error)
+	{
+		while (ops.count > 0)
+		{
+			reduce_pending_op(parser, &ops, &operands);
+		}
+		result = operands.items[0];
+	}
+	else
+	{
+		for (long i = 0; i < operands.count; i++)
+		{
+			free_ast(operands.items[i]);
+		}
+		for (long i = 0; i < ops.count; i++)
+		{
+			if (ops.items[i].call != NULL) free_ast(ops.items[i].call);
+		}
+	}
+	
+	free(ops.items);
+	free(operands.items);
+	return result;
+}
+
+// Equal values are ordered as they appear in the source, so a duplicate
+// always comes after the value it repeats
+int compare_match_case_locs(const AST_Match_Case *a, const AST_Match_Case *b)
+{
+	if (a->loc.line != b->loc.line) return a->loc.line < b->loc.line ? -1 : 1;
+	return a->loc.column < b->loc.column ? -1 : a->loc.column > b->loc.column;
+}
+
+int compare_match_cases(const void *a, const void *b)
+{
+	long left = ((const AST_Match_Case *)a)->value;
+	long right = ((const AST_Match_Case *)b)->value;
+	if (left != right) return left < right ? -1 : 1;
+	return compare_match_case_locs(a, b);
+}
+
+int compare_match_cases_unsigned(const void *a, const void *b)
+{
+	unsigned long left = ((const AST_Match_Case *)a)->value;
+	unsigned long right = ((const AST_Match_Case *)b)->value;
+	if (left != right) return left < right ? -1 : 1;
+	return compare_match_case_locs(a, b);
+}
+
+// The head of one arm of a match: value, value, ... =>, or else =>. Values
+// are integer constants of the matched type. Returns the list the arm's body
+// goes in, which parse_block fills in, or NULL on error
+AST_List *parse_match_arm(Parser *parser, AST_Node *match, Type type, bool *has_else)
+{
+	AST_Match_Data *data = &match->match;
 	Token *tok = peek_token(parser, 0);
+	if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_else)
+	{
+		if (*has_else)
+		{
+			report_error(parser, tok, "ERROR: Match has more than one else arm\n");
+			return NULL;
+		}
+		*has_else = true;
+		++parser->tok_index; // Advance past 'else'
+		
+		expect_token(parser, TOKEN_FAT_ARROW);
+		if (parser->has_error) return NULL;
+		return &data->else_body;
+	}
 	
-	if (tok->kind == TOKEN_INTEGER)
+	while (!parser->has_error)
 	{
-		++parser->tok_index; // Advance past integer
-		AST_Node *result = make_ast_node(AST_INTEGER);
-		result->int_value = tok->int_value;
-		return result;
+		Token *value_tok = peek_token(parser, 0);
+		AST_Node *value = parse_expression(parser);
+		if (parser->has_error) return NULL;
+		
+		if (value->kind != AST_INTEGER)
+		{
+			report_error(parser, value_tok, "ERROR: Match values must be integer constants\n");
+			free_ast(value);
+			return NULL;
+		}
+		coerce_expr(parser, value, type, value_tok);
+		
+		data->cases = realloc(data->cases, (data->case_count + 1) * sizeof(AST_Match_Case));
+		data->cases[data->case_count++] = (AST_Match_Case){value->int_value, data->arm_count, value_tok->loc};
+		free_ast(value);
+		
+		if (peek_token(parser, 0)->kind != ',') break;
+		++parser->tok_index; // Advance past ','
 	}
 	
-	report_error(parser, tok, "ERROR: Expected expression\n");
-	return NULL;
+	expect_token(parser, TOKEN_FAT_ARROW);
+	if (parser->has_error) return NULL;
+	
+	// Arms are only added once the previous one is done, so this stays put
+	// while its body is parsed
+	data->arms = realloc(data->arms, (data->arm_count + 1) * sizeof(AST_List));
+	data->arms[data->arm_count] = (AST_List){0};
+	return &data->arms[data->arm_count++];
+}
+
+// Once all arms are in: sorts the cases, for the duplicate check and for codegen
+void sort_match_cases(Parser *parser, AST_Node *match, Type type)
+{
+	AST_Match_Data *data = &match->match;
+	qsort(data->cases, data->case_count, sizeof(AST_Match_Case),
+	      type_is_signed[type] ? compare_match_cases : compare_match_cases_unsigned);
+	for (long i = 1; i < data->case_count; i++)
+	{
+		if (data->cases[i].value != data->cases[i - 1].value) continue;
+		
+		print_loc(parser->err_file, data->cases[i].loc);
+		fprintf(parser->err_file, type_is_signed[type] ? ": ERROR: Duplicate match value %ld" : ": ERROR: Duplicate match value %lu",
+		        data->cases[i].value);
+		fprintf(parser->err_file, ", previously matched at ");
+		print_loc(parser->err_file, data->cases[i - 1].loc);
+		fprintf(parser->err_file, "\n");
+		parser->has_error = true;
+		return;
+	}
 }
 
+// Loops and matches come back with only their head parsed, see parse_block
 AST_Node *parse_statement(Parser *parser)
 {
 	Token *tok = peek_token(parser, 0);
@@ -215,16 +1006,136 @@ AST_Node *parse_statement(Parser *parser)
 		if (next_tok->kind != '}' && next_tok->kind != TOKEN_EOF)
 		{
 			result->ret_expr = parse_expression(parser);
+			if (parser->has_error) return result;
+			coerce_expr(parser, result->ret_expr, parser->return_type, tok);
+		}
+		
+		return result;
+	}
+	
+	if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_print)
+	{
+		++parser->tok_index; // Advance past 'print'
+		
+		AST_Node *result = make_ast_node(AST_PRINT);
+		result->print_expr = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		check_has_value(parser, result->print_expr, tok);
+		return result;
+	}
+	
+	if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_let)
+	{
+		++parser->tok_index; // Advance past 'let'
+		
+		Token *name = expect_token(parser, TOKEN_IDENT);
+		if (parser->has_error) return NULL;
+		
+		// let name: type = value, or let name = value to take the value's type
+		Type type = TYPE_NONE;
+		if (peek_token(parser, 0)->kind == ':')
+		{
+			++parser->tok_index; // Advance past ':'
+			expect_type(parser, &type);
+			if (parser->has_error) return NULL;
 		}
 		
+		expect_token(parser, '=');
+		if (parser->has_error) return NULL;
+		
+		AST_Node *result = make_ast_node(AST_LET);
+		result->assign.value = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		coerce_expr(parser, result->assign.value, type, name);
+		if (parser->has_error) return result;
+		if (type == TYPE_NONE)
+		{
+			type = result->assign.value->value_type != TYPE_NONE ? result->assign.value->value_type : TYPE_i64;
+		}
+		
+		// Declared after the value, so the value can't refer to the variable itself
+		result->assign.var.name = name->text;
+		result->assign.var.slot = parser->local_count;
+		result->assign.var.type = type;
+		Symbol *existing = symbol_table_insert(&parser->locals, name->text, name->loc, result);
+		if (existing != NULL)
+		{
+			report_error(parser, name, "ERROR: Duplicate declaration of variable ");
+			fprintf(parser->err_file, "%.*s, previously declared at ", PRINT_STRING(name->text));
+			print_loc(parser->err_file, existing->loc);
+			fprintf(parser->err_file, "\n");
+			return result;
+		}
+		parser->local_count++;
+		
 		return result;
 	}
 	
+	if (tok->kind == TOKEN_IDENT && peek_token(parser, 1)->kind == '(')
+	{
+		// A call made for its side effects, dropping any value it returns
+		AST_Node *result = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		if (result->kind != AST_CALL)
+		{
+			report_error(parser, tok, "ERROR: Expected statement\n");
+		}
+		return result;
+	}
+	
+	if (tok->kind == TOKEN_IDENT && peek_token(parser, 1)->kind == '=')
+	{
+		Symbol *local = NULL;
+		expect_local(parser, &local);
+		if (parser->has_error) return NULL;
+		++parser->tok_index; // Advance past '='
+		
+		AST_Node *result = make_ast_node(AST_ASSIGN);
+		result->assign.var = local->node->assign.var;
+		result->assign.value = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		coerce_expr(parser, result->assign.value, result->assign.var.type, tok);
+		return result;
+	}
+	
+	if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_while)
+	{
+		++parser->tok_index; // Advance past 'while'
+		
+		AST_Node *result = make_ast_node(AST_WHILE);
+		result->loop.index = parser->loop_count++;
+		result->loop.cond = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		check_has_value(parser, result->loop.cond, tok);
+		return result; // parse_block fills in the body
+	}
+	
+	if (tok->kind == TOKEN_KEYWORD && tok->keyword == KEYWORD_match)
+	{
+		++parser->tok_index; // Advance past 'match'
+		
+		AST_Node *result = make_ast_node(AST_MATCH);
+		result->match.index = parser->match_count++;
+		result->match.value = parse_expression(parser);
+		if (parser->has_error) return result;
+		
+		check_has_value(parser, result->match.value, tok);
+		return result; // parse_block fills in the arms
+	}
+	
 	report_error(parser, tok, "ERROR: Expected statement\n");
 	return NULL;
 }
 
-AST_Node *parse_fn_def(Parser *parser)
+// First pass over a function: fn name(param: type, ...) -> type. Every
+// signature is read before any body, so calls can be checked against
+// functions defined later in the file
+AST_Node *parse_fn_signature(Parser *parser)
 {
 	AST_Node *result = make_ast_node(AST_FN);
 	
@@ -233,54 +1144,127 @@ AST_Node *parse_fn_def(Parser *parser)
 	
 	Token *name = expect_token(parser, TOKEN_IDENT);
 	if (parser->has_error) return result;
+	result->fn.name = name->text;
 	
 	expect_token(parser, '(');
 	if (parser->has_error) return result;
 	
-	// Parse parameters (TODO later)
+	// Parameters are the function's first locals, in slots 0, 1, ...
+	while (peek_token(parser, 0)->kind != ')')
+	{
+		if (result->fn.parameters.count > 0)
+		{
+			expect_token(parser, ',');
+			if (parser->has_error) return result;
+		}
+		
+		Token *param_name = expect_token(parser, TOKEN_IDENT);
+		if (parser->has_error) return result;
+		expect_token(parser, ':');
+		if (parser->has_error) return result;
+		
+		AST_Node *param = make_ast_node(AST_PARAM);
+		param->assign.var.name = param_name->text;
+		param->assign.var.slot = result->fn.parameters.count;
+		param->assign.loc = param_name->loc;
+		ast_list_append(&result->fn.parameters, param);
+		expect_type(parser, &param->assign.var.type);
+		if (parser->has_error) return result;
+		
+		for (AST_Node *other = result->fn.parameters.first; other != param; other = other->next)
+		{
+			if (str_equal(other->assign.var.name, param->assign.var.name))
+			{
+				report_error(parser, param_name, "ERROR: Duplicate parameter ");
+				fprintf(parser->err_file, "%.*s\n", PRINT_STRING(param_name->text));
+				return result;
+			}
+		}
+		if (result->fn.parameters.count > MAX_PARAMS)
+		{
+			report_error(parser, param_name, "ERROR: Functions can take at most 6 parameters\n");
+			return result;
+		}
+	}
 	
 	expect_token(parser, ')');
 	if (parser->has_error) return result;
 	
 	// Check for ->
-	Type return_type = TYPE_NONE;
 	Token *maybe_arrow = peek_token(parser, 0);
-	
 	if (maybe_arrow->kind == TOKEN_ARROW)
 	{
 		++parser->tok_index; // Advance past arrow
 		
-		Token *ret_type_token = expect_token(parser, TOKEN_TYPE);
+		expect_type(parser, &result->fn.return_type);
 		if (parser->has_error) return result;
-		
-		return_type = ret_type_token->type; // Since it's a type, it has type information
 	}
 	
-	// For parsing the body of the function, we should probably have a dedicated
-	// parse_block function that we can reuse for other places blocks occur,
-	// like if and while statements.
-	AST_List body = parse_block(parser);
-	if (parser->has_error) return result;
-	// TODO: Fill this result out with the information we gathered above
-	
-	// Fill in the result with the information we gathered above
-	result->fn.name = name->text;
-	result->fn.return_type = return_type;
-	result->fn.body = body;
-	// Parameters list is already initialized to {0}
+	result->fn.index = parser->fns.count;
+	Symbol *existing = symbol_table_insert(&parser->fns, name->text, name->loc, result);
+	if (existing != NULL)
+	{
+		report_error(parser, name, "ERROR: Duplicate definition of function ");
+		fprintf(parser->err_file, "%.*s, previously defined at ", PRINT_STRING(name->text));
+		print_loc(parser->err_file, existing->loc);
+		fprintf(parser->err_file, "\n");
+	}
 	
 	return result;
 }
 
+// Steps over a block without parsing it, for the first pass
+void skip_block(Parser *parser)
+{
+	Token *open = expect_token(parser, '{');
+	if (parser->has_error) return;
+	
+	long depth = 1;
+	while (depth > 0)
+	{
+		Token *tok = peek_token(parser, 0);
+		if (tok->kind == TOKEN_EOF)
+		{
+			report_error(parser, open, "ERROR: Unclosed '{'\n");
+			return;
+		}
+		if (tok->kind == '{') depth++;
+		if (tok->kind == '}') depth--;
+		++parser->tok_index;
+	}
+}
+
+// Second pass over a function, once every signature is known
+void parse_fn_body(Parser *parser, AST_Node *fn_node)
+{
+	// Variables are scoped to the function
+	free(parser->locals.items);
+	parser->locals = (Symbol_Table){0};
+	parser->local_count = 0;
+	parser->loop_count = 0;
+	parser->match_count = 0;
+	parser->return_type = fn_node->fn.return_type;
+	
+	for (AST_Node *param = fn_node->fn.parameters.first; param != NULL; param = param->next)
+	{
+		symbol_table_insert(&parser->locals, param->assign.var.name, param->assign.loc, param);
+		parser->local_count++;
+	}
+	
+	fn_node->fn.body = parse_block(parser);
+	fn_node->fn.local_count = parser->local_count;
+}
+
 // We could just return NULL on error, but it might be nice to see
 // the partial result that was created before the error ocurred
 typedef struct Parse_Result
 {
 	AST_Node *ast;
+	Symbol_Table fns;
 	bool success;
 } Parse_Result;
 
-Parse_Result parse_program(Token_Array tokens)
+Parse_Result parse_program(Token_Array tokens, FILE *err_file)
 {
 	Parse_Result result = {
 		.ast = make_ast_node(AST_PROGRAM),
@@ -290,8 +1274,25 @@ Parse_Result parse_program(Token_Array tokens)
 	Parser parser = {
 		.tokens = tokens,
 		.tok_index = 0,
+		.err_file = err_file,
+		.missing_eof = {.kind = TOKEN_EOF},
 	};
 	
+	// Every function starts with 'fn', so counting them up front sizes the
+	// symbol table once and it never has to rehash while parsing
+	long fn_count = 0;
+	for (long i = 0; i < tokens.count; i++)
+	{
+		if (tokens.items[i].kind == TOKEN_KEYWORD && tokens.items[i].keyword == KEYWORD_fn)
+		{
+			fn_count++;
+		}
+	}
+	symbol_table_reserve(&parser.fns, fn_count);
+	
+	// Where each function's body starts, for the second pass
+	long *body_starts = malloc((fn_count + 1) * sizeof(long));
+	
 	while (parser.tok_index < tokens.count)
 	{
 		Token *tok = peek_token(&parser, 0);
@@ -305,7 +1306,7 @@ Parse_Result parse_program(Token_Array tokens)
 		// I'm parsing a program
 		// So I should expect a list of function definition
 		// So at the top of the while loop I'll assume we are at the start of a function definition
-		AST_Node *fn_def = parse_fn_def(&parser);
+		AST_Node *fn_def = parse_fn_signature(&parser);
 		
 		// append this to the list that the program keeps
 		ast_list_append(&result.ast->program, fn_def);
@@ -315,11 +1316,107 @@ Parse_Result parse_program(Token_Array tokens)
 		{
 			break;
 		}
+		
+		body_starts[result.ast->program.count - 1] = parser.tok_index;
+		skip_block(&parser);
+		if (parser.has_error)
+		{
+			break;
+		}
+	}
+	
+	long fn_index = 0;
+	for (AST_Node *fn_node = result.ast->program.first; fn_node != NULL && !parser.has_error; fn_node = fn_node->next)
+	{
+		parser.tok_index = body_starts[fn_index++];
+		parse_fn_body(&parser, fn_node);
 	}
+	free(body_starts);
+	
+	free(parser.locals.items);
+	result.fns = parser.fns;
 	result.success = !parser.has_error;
 	return result;
 }
 
+// Frees node and everything under it. Uses a worklist rather than recursion,
+// since expressions can nest arbitrarily deep
+void free_ast(AST_Node *node)
+{
+	AST_Node_Array pending = {0};
+	if (node != NULL) ast_node_array_append(&pending, node);
+	
+	while (pending.count > 0)
+	{
+		node = pending.items[--pending.count];
+		
+		AST_List *children = NULL;
+		switch (node->kind)
+		{
+		case AST_PROGRAM: children = &node->program; break;
+		case AST_FN: {
+			for (AST_Node *param = node->fn.parameters.first; param != NULL; param = param->next)
+			{
+				ast_node_array_append(&pending, param);
+			}
+			children = &node->fn.body;
+		} break;
+		case AST_RETURN: {
+			if (node->ret_expr != NULL) ast_node_array_append(&pending, node->ret_expr);
+		} break;
+		case AST_PRINT: {
+			if (node->print_expr != NULL) ast_node_array_append(&pending, node->print_expr);
+		} break;
+		case AST_LET:
+		case AST_ASSIGN: {
+			if (node->assign.value != NULL) ast_node_array_append(&pending, node->assign.value);
+		} break;
+		case AST_WHILE: {
+			if (node->loop.cond != NULL) ast_node_array_append(&pending, node->loop.cond);
+			children = &node->loop.body;
+		} break;
+		case AST_MATCH: {
+			if (node->match.value != NULL) ast_node_array_append(&pending, node->match.value);
+			for (long i = 0; i < node->match.arm_count; i++)
+			{
+				for (AST_Node *child = node->match.arms[i].first; child != NULL; child = child->next)
+				{
+					ast_node_array_append(&pending, child);
+				}
+			}
+			free(node->match.arms);
+			free(node->match.cases);
+			children = &node->match.else_body;
+		} break;
+		case AST_NEGATE:
+		case AST_CAST: ast_node_array_append(&pending, node->operand); break;
+		case AST_BINARY_OP: {
+			ast_node_array_append(&pending, node->binary_op.left);
+			ast_node_array_append(&pending, node->binary_op.right);
+		} break;
+		case AST_CALL: {
+			for (long i = 0; i < node->call.arg_count; i++)
+			{
+				ast_node_array_append(&pending, node->call.args[i]);
+			}
+			free(node->call.args);
+		} break;
+		default: break;
+		}
+		
+		if (children != NULL)
+		{
+			for (AST_Node *child = children->first; child != NULL; child = child->next)
+			{
+				ast_node_array_append(&pending, child);
+			}
+		}
+		free(node);
+	}
+	
+	free(pending.items);
+}
+
 void print_ast_with_indent(AST_Node *node, int depth)
 {
 	switch (node->kind)
@@ -337,8 +1434,12 @@ void print_ast_with_indent(AST_Node *node, int depth)
 	} break;
 	
 	case AST_FN: {
-		printf("%*sfn %.*s(\n", 2*depth, "", PRINT_STRING(node->fn.name));
-		// TODO: Print function parameters
+		printf("%*sfn %.*s(", 2*depth, "", PRINT_STRING(node->fn.name));
+		for (AST_Node *param = node->fn.parameters.first; param != NULL; param = param->next)
+		{
+			printf("%.*s: %.*s%s", PRINT_STRING(param->assign.var.name), PRINT_STRING(type_names[param->assign.var.type]),
+			       param->next != NULL ? ", " : "");
+		}
 		printf(")\n");
 		for (AST_Node *body_node = node->fn.body.first; body_node != NULL; body_node = body_node->next)
 		{
@@ -358,8 +1459,84 @@ void print_ast_with_indent(AST_Node *node, int depth)
 		}
 	} break;
 	
+	case AST_PRINT: {
+		printf("%*sprint\n", 2*depth, "");
+		print_ast_with_indent(node->print_expr, depth + 1);
+	} break;
+	
 	case AST_INTEGER: {
-		printf("%*sinteger %ld\n", 2*depth, "", node->int_value);
+		printf("%*sinteger %ld", 2*depth, "", node->int_value);
+		if (node->value_type != TYPE_NONE) printf(" %.*s", PRINT_STRING(type_names[node->value_type]));
+		printf("\n");
+	} break;
+	
+	case AST_NEGATE: {
+		printf("%*snegate\n", 2*depth, "");
+		print_ast_with_indent(node->operand, depth + 1);
+	} break;
+	
+	case AST_CAST: {
+		printf("%*scast to %.*s\n", 2*depth, "", PRINT_STRING(type_names[node->value_type]));
+		print_ast_with_indent(node->operand, depth + 1);
+	} break;
+	
+	case AST_VAR: {
+		printf("%*svar %.*s\n", 2*depth, "", PRINT_STRING(node->var.name));
+	} break;
+	
+	case AST_CALL: {
+		printf("%*scall %.*s\n", 2*depth, "", PRINT_STRING(node->call.name));
+		for (long i = 0; i < node->call.arg_count; i++)
+		{
+			print_ast_with_indent(node->call.args[i], depth + 1);
+		}
+	} break;
+	
+	case AST_LET:
+	case AST_ASSIGN: {
+		printf("%*s%s %.*s: %.*s\n", 2*depth, "", node->kind == AST_LET ? "let" : "assign",
+		       PRINT_STRING(node->assign.var.name), PRINT_STRING(type_names[node->assign.var.type]));
+		print_ast_with_indent(node->assign.value, depth + 1);
+	} break;
+	
+	case AST_WHILE: {
+		printf("%*swhile\n", 2*depth, "");
+		print_ast_with_indent(node->loop.cond, depth + 1);
+		for (AST_Node *body_node = node->loop.body.first; body_node != NULL; body_node = body_node->next)
+		{
+			print_ast_with_indent(body_node, depth + 1);
+		}
+	} break;
+	
+	case AST_MATCH: {
+		printf("%*smatch\n", 2*depth, "");
+		print_ast_with_indent(node->match.value, depth + 1);
+		for (long arm = 0; arm < node->match.arm_count; arm++)
+		{
+			printf("%*sarm", 2*depth + 2, "");
+			for (long i = 0; i < node->match.case_count; i++)
+			{
+				if (node->match.cases[i].arm == arm) printf(" %ld", node->match.cases[i].value);
+			}
+			printf("\n");
+			for (AST_Node *body_node = node->match.arms[arm].first; body_node != NULL; body_node = body_node->next)
+			{
+				print_ast_with_indent(body_node, depth + 2);
+			}
+		}
+		printf("%*selse\n", 2*depth + 2, "");
+		for (AST_Node *body_node = node->match.else_body.first; body_node != NULL; body_node = body_node->next)
+		{
+			print_ast_with_indent(body_node, depth + 2);
+		}
+	} break;
+	
+	case AST_BINARY_OP: {
+		printf("%*sbinary_op ", 2*depth, "");
+		print_token_kind(stdout, node->binary_op.op);
+		printf("\n");
+		print_ast_with_indent(node->binary_op.left, depth + 1);
+		print_ast_with_indent(node->binary_op.right, depth + 1);
 	} break;
 	
 	default: {
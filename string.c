@@ -12,4 +12,44 @@ String str_from_cstr(const char *cstr)
 {
 	String result = {(char *)cstr, strlen(cstr)};
 	return result;
+}
+
+bool str_equal(String a, String b)
+{
+	return a.count == b.count && memcmp(a.data, b.data, a.count) == 0;
+}
+
+// FNV-1a, good enough for identifiers and cheap to compute
+unsigned long str_hash(String s)
+{
+	unsigned long hash = 14695981039346656037UL;
+	for (long i = 0; i < s.count; i++)
+	{
+		hash ^= (unsigned char)s.data[i];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+char *read_entire_file(const char *file_name, long *size, FILE *err_file)
+{
+	FILE *file = fopen(file_name, "rb");
+	if (!file)
+	{
+		fprintf(err_file, "ERROR: Could not open file %s\n", file_name);
+		return NULL;
+	}
+	
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	
+	char *data = malloc(file_size + 1);
+	fread(data, 1, file_size, file);
+	data[file_size] = '\0';
+	
+	fclose(file);
+	
+	*size = file_size;
+	return data;
 }
\ No newline at end of file
@@ -0,0 +1,380 @@
+// Watch mode: stay resident, keep every .jive file of a directory lexed and
+// parsed in memory, and recompile a file only when its contents change.
+// Compile requests can also be sent over a Unix socket, one input path per
+// line, and are answered with "OK output.asm\n" or "ERROR\n".
+
+typedef struct Watched_File
+{
+	char *path;       // dir/name.jive
+	char *out_path;   // dir/name.asm
+	
+	// State from the last compile, kept so unchanged files cost nothing
+	char *source;
+	long source_len;
+	Token_Array tokens;
+	AST_Node *ast;
+	Symbol_Table fns;
+	char *asm_text;
+	long asm_len;
+	bool success;
+} Watched_File;
+
+typedef struct Watched_File_Array
+{
+	Watched_File *items;
+	long count;
+	long capacity;
+} Watched_File_Array;
+
+bool has_jive_extension(const char *name)
+{
+	long len = strlen(name);
+	return len > 5 && strcmp(name + len - 5, ".jive") == 0;
+}
+
+Watched_File *find_watched_file(Watched_File_Array *files, const char *path)
+{
+	for (long i = 0; i < files->count; i++)
+	{
+		if (strcmp(files->items[i].path, path) == 0)
+		{
+			return &files->items[i];
+		}
+	}
+	return NULL;
+}
+
+Watched_File *add_watched_file(Watched_File_Array *files, const char *path)
+{
+	if (files->count >= files->capacity)
+	{
+		files->capacity = files->capacity == 0 ? 16 : files->capacity * 2;
+		files->items = realloc(files->items, files->capacity * sizeof(Watched_File));
+	}
+	
+	Watched_File *file = &files->items[files->count++];
+	*file = (Watched_File){0};
+	file->path = strdup(path);
+	
+	long len = strlen(path);
+	file->out_path = malloc(len + 1);
+	memcpy(file->out_path, path, len - 5);
+	strcpy(file->out_path + len - 5, ".asm");
+	
+	return file;
+}
+
+void free_compiled_state(Watched_File *file)
+{
+	free_ast(file->ast);
+	free(file->tokens.items);
+	free(file->fns.items);
+	free(file->source);
+	file->ast = NULL;
+	file->tokens = (Token_Array){0};
+	file->fns = (Symbol_Table){0};
+	file->source = NULL;
+	file->source_len = 0;
+}
+
+void remove_watched_file(Watched_File_Array *files, Watched_File *file)
+{
+	free_compiled_state(file);
+	free(file->asm_text);
+	free(file->path);
+	free(file->out_path);
+	*file = files->items[--files->count];
+}
+
+bool write_watched_output(Watched_File *file, char *asm_text, long asm_len)
+{
+	FILE *out_file = fopen(file->out_path, "w");
+	if (!out_file)
+	{
+		printf("ERROR: Could not open %s for writing.\n", file->out_path);
+		return false;
+	}
+	fwrite(asm_text, 1, asm_len, out_file);
+	fclose(out_file);
+	printf("Compiled %s -> %s\n", file->path, file->out_path);
+	return true;
+}
+
+// Recompiles file if its contents changed since the last compile, and only
+// rewrites the output when the generated asm actually differs, or the output
+// is gone
+bool compile_watched_file(Watched_File *file, Codegen_Options *options)
+{
+	long source_len = 0;
+	char *source = read_entire_file(file->path, &source_len, stdout);
+	if (source == NULL) return false;
+	
+	if (file->source != NULL && source_len == file->source_len &&
+	    memcmp(source, file->source, source_len) == 0)
+	{
+		free(source);
+		if (file->success && access(file->out_path, F_OK) != 0)
+		{
+			return write_watched_output(file, file->asm_text, file->asm_len);
+		}
+		return file->success;
+	}
+	
+	free_compiled_state(file);
+	file->source = source;
+	file->source_len = source_len;
+	file->success = false;
+	
+	file->tokens = lex_buffer(file->path, source, source_len, stdout);
+	
+	Parse_Result parse_result = parse_program(file->tokens, stdout);
+	file->ast = parse_result.ast;
+	file->fns = parse_result.fns;
+	if (!parse_result.success)
+	{
+		printf("ERROR: Failed to parse %s.\n", file->path);
+		return false;
+	}
+	
+	if (options->profile_file_name != NULL && !load_profile(options->profile_file_name, &file->fns, stdout))
+	{
+		printf("ERROR: Failed to load profile.\n");
+		return false;
+	}
+	
+	char *asm_text = NULL;
+	size_t asm_len = 0;
+	FILE *asm_stream = open_memstream(&asm_text, &asm_len);
+	bool success = generate_asm(file->ast, options, asm_stream, stdout);
+	fclose(asm_stream);
+	if (!success)
+	{
+		free(asm_text);
+		return false;
+	}
+	
+	if (file->asm_text == NULL || (long)asm_len != file->asm_len ||
+	    memcmp(asm_text, file->asm_text, asm_len) != 0 || access(file->out_path, F_OK) != 0)
+	{
+		if (!write_watched_output(file, asm_text, asm_len))
+		{
+			free(asm_text);
+			return false;
+		}
+	}
+	
+	free(file->asm_text);
+	file->asm_text = asm_text;
+	file->asm_len = asm_len;
+	file->success = true;
+	return true;
+}
+
+// A client that never finishes its request only holds up the daemon this long
+#define COMPILE_REQUEST_TIMEOUT_MS 1000
+
+// Whether path names a file directly inside dir_name, spelled the way the
+// watcher spells the paths it keeps
+bool is_in_watched_dir(const char *path, const char *dir_name)
+{
+	long dir_len = strlen(dir_name);
+	return strncmp(path, dir_name, dir_len) == 0 && path[dir_len] == '/' &&
+		strchr(path + dir_len + 1, '/') == NULL;
+}
+
+void serve_compile_request(int client, const char *dir_name, Watched_File_Array *files, Codegen_Options *options)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	char request[4096];
+	long request_len = 0;
+	while (request_len < (long)sizeof(request) - 1)
+	{
+		// The whole request has one deadline, so trickling bytes doesn't extend it
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+		struct pollfd client_fd = {.fd = client, .events = POLLIN};
+		if (elapsed_ms >= COMPILE_REQUEST_TIMEOUT_MS ||
+			poll(&client_fd, 1, COMPILE_REQUEST_TIMEOUT_MS - elapsed_ms) <= 0)
+		{
+			printf("ERROR: Compile request timed out\n");
+			break;
+		}
+		
+		long got = read(client, request + request_len, sizeof(request) - 1 - request_len);
+		if (got <= 0) break;
+		request_len += got;
+		if (memchr(request, '\n', request_len) != NULL) break;
+	}
+	request[request_len] = '\0';
+	request[strcspn(request, "\r\n")] = '\0';
+	
+	char response[4200];
+	snprintf(response, sizeof(response), "ERROR\n");
+	
+	if (has_jive_extension(request) && is_in_watched_dir(request, dir_name))
+	{
+		Watched_File *file = find_watched_file(files, request);
+		if (file == NULL)
+		{
+			file = add_watched_file(files, request);
+		}
+		if (compile_watched_file(file, options))
+		{
+			snprintf(response, sizeof(response), "OK %s\n", file->out_path);
+		}
+	}
+	else if (has_jive_extension(request))
+	{
+		// Files outside the directory are compiled once and not kept, since
+		// nothing would tell us when they change or go away
+		Watched_File_Array scratch = {0};
+		Watched_File *file = add_watched_file(&scratch, request);
+		if (compile_watched_file(file, options))
+		{
+			snprintf(response, sizeof(response), "OK %s\n", file->out_path);
+		}
+		remove_watched_file(&scratch, file);
+		free(scratch.items);
+	}
+	else
+	{
+		printf("ERROR: Compile request is not a .jive file: %s\n", request);
+	}
+	
+	// The client may have hung up already, which mustn't take the daemon down
+	// with a SIGPIPE
+	long response_len = strlen(response);
+	if (send(client, response, response_len, MSG_NOSIGNAL) != response_len)
+	{
+		printf("ERROR: Could not reply to compile request for %s\n", request);
+	}
+}
+
+int watch_directory(const char *dir_arg, const char *socket_name, Codegen_Options *options)
+{
+	Watched_File_Array files = {0};
+	char path[4096];
+	
+	// Without trailing slashes, so kept paths are spelled dir/x.jive, the same
+	// as compile requests name them
+	char dir_name[1024];
+	if (strlen(dir_arg) >= sizeof(dir_name))
+	{
+		printf("ERROR: Directory path %s is too long\n", dir_arg);
+		return 1;
+	}
+	strcpy(dir_name, dir_arg);
+	for (long len = strlen(dir_name); len > 1 && dir_name[len - 1] == '/'; len--)
+	{
+		dir_name[len - 1] = '\0';
+	}
+	
+	//
+	// Compile everything once up front
+	//
+	
+	DIR *dir = opendir(dir_name);
+	if (!dir)
+	{
+		printf("ERROR: Could not open directory %s\n", dir_name);
+		return 1;
+	}
+	for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+	{
+		if (!has_jive_extension(entry->d_name)) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir_name, entry->d_name);
+		compile_watched_file(add_watched_file(&files, path), options);
+	}
+	closedir(dir);
+	
+	int inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (inotify_fd < 0 ||
+	    inotify_add_watch(inotify_fd, dir_name, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0)
+	{
+		printf("ERROR: Could not watch directory %s\n", dir_name);
+		return 1;
+	}
+	
+	//
+	// Listen for compile requests
+	//
+	
+	char default_socket_name[4096];
+	if (socket_name == NULL)
+	{
+		snprintf(default_socket_name, sizeof(default_socket_name), "%s/.jive.sock", dir_name);
+		socket_name = default_socket_name;
+	}
+	
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(socket_name) >= sizeof(address.sun_path))
+	{
+		printf("ERROR: Socket path %s is too long\n", socket_name);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_name);
+	unlink(socket_name);
+	
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0 ||
+	    bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	    listen(listen_fd, 16) < 0)
+	{
+		printf("ERROR: Could not listen on %s\n", socket_name);
+		return 1;
+	}
+	
+	printf("Watching %s, listening on %s\n", dir_name, socket_name);
+	fflush(stdout);
+	
+	while (true)
+	{
+		struct pollfd fds[2] = {
+			{.fd = inotify_fd, .events = POLLIN},
+			{.fd = listen_fd,  .events = POLLIN},
+		};
+		if (poll(fds, 2, -1) < 0) continue;
+		
+		if (fds[0].revents & POLLIN)
+		{
+			char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			long events_len = read(inotify_fd, events, sizeof(events));
+			for (long offset = 0; offset < events_len; )
+			{
+				struct inotify_event *event = (struct inotify_event *)&events[offset];
+				offset += sizeof(struct inotify_event) + event->len;
+				
+				if (event->len == 0 || !has_jive_extension(event->name)) continue;
+				snprintf(path, sizeof(path), "%s/%s", dir_name, event->name);
+				
+				Watched_File *file = find_watched_file(&files, path);
+				if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+				{
+					if (file != NULL) remove_watched_file(&files, file);
+				}
+				else
+				{
+					if (file == NULL) file = add_watched_file(&files, path);
+					compile_watched_file(file, options);
+				}
+			}
+		}
+		
+		if (fds[1].revents & POLLIN)
+		{
+			int client = accept(listen_fd, NULL, NULL);
+			if (client >= 0)
+			{
+				serve_compile_request(client, dir_name, &files, options);
+				close(client);
+			}
+		}
+		
+		fflush(stdout);
+	}
+	
+	return 0;
+}
\ No newline at end of file